@@ -0,0 +1,40 @@
+#include "bench.h"
+
+// Runs the suites named on the command line, or all of them
+
+static struct {
+    const char *name;
+    int (*run)();
+} suites[] = {
+    { "scan", benchScan },
+    { "syntax", benchSyntax },
+    { "edit", benchEdit },
+};
+
+#define SUITES (sizeof(suites) / sizeof(suites[0]))
+
+double benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void benchReport(const char *name, double value, const char *unit) {
+    // Counts are printed as integers, rates with one decimal
+    printf("%s\t%.*f\t%s\n", name, value == (long long)value ? 0 : 1, value, unit);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    for (unsigned int i = 0; i < SUITES; i++) {
+        int wanted = argc < 2;
+        for (int a = 1; a < argc; a++)
+            if (strcmp(argv[a], suites[i].name) == 0) wanted = 1;
+        
+        if (wanted && suites[i].run() != 0) {
+            fprintf(stderr, "%s: failed\n", suites[i].name);
+            return 1;
+        }
+    }
+    return 0;
+}
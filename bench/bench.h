@@ -0,0 +1,16 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "axcode.h"
+
+// Every result is printed as "name<TAB>value<TAB>unit"
+
+double benchNow();
+void benchReport(const char *name, double value, const char *unit);
+
+// Suites, returning non-zero on failure
+int benchScan();
+int benchSyntax();
+int benchEdit();
+
+#endif /* BENCH_H */
@@ -0,0 +1,281 @@
+#include "bench.h"
+#include <stdarg.h>
+
+// Times the core operations of a buffer on synthetic files of four shapes:
+// reading and writing them, random single-character inserts and row
+// deletions, and highlighting every row. The inputs are made from fixed
+// seeds, so every version is timed on the same bytes and the same edits.
+
+#define BENCH_EDIT_SIZE (8 * 1024 * 1024)
+#define BENCH_RUNS 5
+
+struct input {
+    const char *name;
+    const char *ext;            // Picks the syntax
+    void (*make)(struct input *in);
+    int ops;                    // Inserts and deletions timed per run
+    char *buf;
+    size_t len;
+};
+
+static unsigned seed;
+
+// xorshift, so row numbers reach past 65535
+static unsigned benchRand() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void put(struct input *in, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    in->len += vsnprintf(&in->buf[in->len], BENCH_EDIT_SIZE + 4096 - in->len, fmt, ap);
+    va_end(ap);
+}
+
+// Lines of up to 16 bytes, blank ones among them
+static void makeShort(struct input *in) {
+    while (in->len < BENCH_EDIT_SIZE)
+        put(in, "%.*s\n", (int)(benchRand() % 17), "x = y + 42; /**/");
+}
+
+// Eight lines of a megabyte each
+static void makeLong(struct input *in) {
+    for (int i = 0; i < 8; i++) {
+        size_t end = in->len + BENCH_EDIT_SIZE / 8;
+        while (in->len < end - 32)
+            put(in, "call(arg%u, %u, \"s\"); ", benchRand() % 100, benchRand());
+        put(in, "\n");
+    }
+}
+
+// C that is mostly block and line comments
+static void makeComments(struct input *in) {
+    while (in->len < BENCH_EDIT_SIZE) {
+        put(in, "/*\n");
+        for (unsigned i = benchRand() % 6 + 2; i > 0; i--)
+            put(in, " * Returns the %u-th value, or -1 if there is none. See f%u().\n", benchRand(), benchRand());
+        put(in, " */\nint f%u(int x) { return x + %u; } // Never negative\n", benchRand(), benchRand() % 1000);
+        put(in, "// int old%u = 0;\n\n", benchRand());
+    }
+}
+
+static void makeAxScript(struct input *in) {
+    while (in->len < BENCH_EDIT_SIZE) {
+        unsigned f = benchRand();
+        put(in, "// Helper %u\nfun f%u(a, b)\n", f, f);
+        put(in, "    var x = a + %u\n    if x compge b and not false\n", benchRand() % 1000);
+        put(in, "        print \"big\"\n    else\n        print x\n");
+        put(in, "    loop i to %u step 2\n        x = x + i\n    return x\n", benchRand() % 100);
+        put(in, "/* f%u is\n   done */\n\n", f);
+    }
+}
+
+static struct input inputs[] = {
+    { "short_lines", ".c", makeShort, 100000, NULL, 0 },
+    { "long_lines", ".c", makeLong, 200, NULL, 0 },
+    { "comments", ".c", makeComments, 100000, NULL, 0 },
+    { "axscript", ".axp", makeAxScript, 100000, NULL, 0 },
+};
+
+#define INPUTS (sizeof(inputs) / sizeof(inputs[0]))
+
+// The operations work on a buffer of their own bound to this thread
+static struct editorConfig buffer;
+static struct editorConfig *prev;
+
+static void bufferOpen(const char *path) {
+    editorContextInit(&buffer);
+    prev = editorBind(&buffer);
+    editorOpen((char *)path);
+}
+
+static void bufferClose() {
+    editorBind(prev);
+    editorContextFree(&buffer);
+}
+
+static void report(struct input *in, const char *what, double value, const char *unit) {
+    char name[64];
+    snprintf(name, sizeof(name), "edit.%s.%s", in->name, what);
+    benchReport(name, value, unit);
+}
+
+// Lex every row from the top, carrying the comment state down, as a full
+// redraw of the file would. The rows are rendered beforehand, so only
+// editorUpdateSyntax is timed.
+static double timeSyntax() {
+    int state = 0;
+    
+    for (int i = 0; i < E.numrows; i++) {
+        erow *row = editorRowAt(i);
+        row->hl_in = state;
+        editorUpdateRow(row);
+        state = row->hl_open_comment;
+    }
+    
+    double start = benchNow();
+    state = 0;
+    for (int i = 0; i < E.numrows; i++) {
+        erow *row = editorRowAt(i);
+        row->hl_in = state;
+        editorUpdateSyntax(row);
+        state = row->hl_open_comment;
+    }
+    return benchNow() - start;
+}
+
+// One keystroke each: a character typed at a random place
+static double timeInserts(int ops) {
+    double start = benchNow();
+    for (int i = 0; i < ops; i++) {
+        erow *row = editorRowAt(benchRand() % E.numrows);
+        editorUndoBreak();
+        editorRowInsertChar(row, benchRand() % (row->size + 1), 'a' + i % 26);
+    }
+    return benchNow() - start;
+}
+
+static double timeDeletes(int ops) {
+    if (ops > E.numrows / 2) ops = E.numrows / 2;
+    
+    double start = benchNow();
+    for (int i = 0; i < ops; i++) {
+        editorUndoBreak();
+        editorDelRow(benchRand() % E.numrows);
+    }
+    return benchNow() - start;
+}
+
+// Typing BENCH_TYPE_OPS characters one after another in the middle of a
+// single line of code of every length, as someone editing it would, shows
+// how the cost of a keystroke grows with the line
+#define BENCH_TYPE_OPS 20000
+
+static int benchTyping() {
+    static const int sizes[] = { 1024, 64 * 1024, 1024 * 1024 };
+    
+    for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        struct input in = { "typing", ".c", NULL, 0, malloc(sizes[s] + 4096), 0 };
+        double best = 1e9;
+        
+        seed = 1;
+        while (in.len < (size_t)sizes[s])
+            put(&in, "call(arg%u, %u, \"s\"); ", benchRand() % 100, benchRand() % 1000);
+        
+        for (int r = 0; r < BENCH_RUNS; r++) {
+            editorContextInit(&buffer);
+            prev = editorBind(&buffer);
+            E.filename = strdup("typing.c");
+            editorSelectSyntaxHighlight();
+            editorInsertRows(0, in.buf, in.len);
+            
+            // The line is on screen, so it is highlighted already
+            erow *row = editorRowAt(0);
+            row->hl_in = 0;
+            editorUpdateRow(row);
+            
+            double start = benchNow();
+            for (int i = 0; i < BENCH_TYPE_OPS; i++) {
+                editorUndoBreak();
+                editorRowInsertChar(editorRowAt(0), in.len / 2 + i, "x = 1; "[i % 7]);
+            }
+            double t = benchNow() - start;
+            if (t < best) best = t;
+            bufferClose();
+        }
+        
+        char name[32];
+        snprintf(name, sizeof(name), "%dk", sizes[s] / 1024);
+        report(&in, name, BENCH_TYPE_OPS / best, "ops/s");
+        free(in.buf);
+    }
+    return 0;
+}
+
+static int benchInput(struct input *in) {
+    char path[64];
+    size_t lines = 0;
+    
+    snprintf(path, sizeof(path), "/tmp/axcode-bench-XXXXXX%s", in->ext);
+    int fd = mkstemps(path, strlen(in->ext));
+    if (fd == -1 || write(fd, in->buf, in->len) != (ssize_t)in->len) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return 1;
+    }
+    close(fd);
+    for (size_t i = 0; i < in->len; i++)
+        if (in->buf[i] == '\n') lines++;
+    
+    double topen = 1e9, tsave = 1e9, tsyntax = 1e9, tinsert = 1e9, tdelete = 1e9;
+    int deletes = 0;
+    
+    for (int r = 0; r < BENCH_RUNS; r++) {
+        double start = benchNow();
+        bufferOpen(path);
+        double t = benchNow() - start;
+        if (t < topen) topen = t;
+        if ((size_t)E.numrows != lines) {
+            fprintf(stderr, "%s: %d rows, expected %zu\n", in->name, E.numrows, lines);
+            bufferClose();
+            return 1;
+        }
+        
+        t = timeSyntax();
+        if (t < tsyntax) tsyntax = t;
+        
+        // Unchanged, so every run writes the same bytes over the input
+        start = benchNow();
+        editorSave();
+        editorSaveWait();
+        t = benchNow() - start;
+        if (t < tsave) tsave = t;
+        if (E.save_error) {
+            fprintf(stderr, "%s: cannot save %s\n", in->name, path);
+            bufferClose();
+            return 1;
+        }
+        bufferClose();
+        
+        // Every run makes the same edits to a freshly read file
+        seed = r + 1;
+        bufferOpen(path);
+        t = timeInserts(in->ops);
+        if (t < tinsert) tinsert = t;
+        bufferClose();
+        
+        seed = r + 1;
+        bufferOpen(path);
+        deletes = in->ops < E.numrows / 2 ? in->ops : E.numrows / 2;
+        t = timeDeletes(in->ops);
+        if (t < tdelete) tdelete = t;
+        bufferClose();
+    }
+    
+    report(in, "rows", lines, "rows");
+    report(in, "open", in->len / topen / 1e6, "MB/s");
+    report(in, "save", in->len / tsave / 1e6, "MB/s");
+    report(in, "syntax", in->len / tsyntax / 1e6, "MB/s");
+    report(in, "insert_char", in->ops / tinsert, "ops/s");
+    report(in, "del_row", deletes / tdelete, "ops/s");
+    unlink(path);
+    return 0;
+}
+
+int benchEdit() {
+    for (unsigned int i = 0; i < INPUTS; i++) {
+        struct input *in = &inputs[i];
+        
+        seed = i + 1;
+        in->buf = malloc(BENCH_EDIT_SIZE + 4096);
+        in->len = 0;
+        in->make(in);
+        
+        int ret = benchInput(in);
+        free(in->buf);
+        if (ret != 0) return ret;
+    }
+    return benchTyping();
+}
@@ -0,0 +1,105 @@
+#include "bench.h"
+
+// Compares the getline loop editorOpen used to split files with against
+// editorScanLines.
+
+#define BENCH_SIZE (256 * 1024 * 1024)
+#define BENCH_RUNS 5
+
+// Log-like text with lines of 20 to 140 bytes, some ending in \r\n
+static char *makeInput(size_t len) {
+    char *buf = malloc(len);
+    size_t i = 0;
+    unsigned seed = 1;
+    
+    while (i < len) {
+        seed = seed * 1103515245 + 12345;
+        size_t linelen = 20 + (seed >> 16) % 120;
+        for (size_t j = 0; j < linelen && i < len; j++)
+            buf[i++] = 'a' + (j * 7 + seed) % 26;
+        if (i < len && (seed & 7) == 0) buf[i++] = '\r';
+        if (i < len) buf[i++] = '\n';
+    }
+    return buf;
+}
+
+static size_t runGetline(const char *path) {
+    FILE *fp = fopen(path, "r");
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    size_t lines = 0;
+    
+    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+            linelen--;
+        lines++;
+    }
+    free(line);
+    fclose(fp);
+    return lines;
+}
+
+static size_t runMapScan(const char *path, int simd) {
+    int fd = open(path, O_RDONLY);
+    char *map = mmap(NULL, BENCH_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    lineIndex idx;
+    
+    close(fd);
+    editorScanLines(&idx, map, BENCH_SIZE, simd);
+    
+    size_t lines = idx.nlines;
+    editorLineIndexFree(&idx);
+    munmap(map, BENCH_SIZE);
+    return lines;
+}
+
+static size_t runScan(const char *buf, int simd) {
+    lineIndex idx;
+    editorScanLines(&idx, buf, BENCH_SIZE, simd);
+    size_t lines = idx.nlines;
+    editorLineIndexFree(&idx);
+    return lines;
+}
+
+int benchScan() {
+    char path[] = "/tmp/axcode-bench-XXXXXX";
+    int fd = mkstemp(path);
+    char *input = makeInput(BENCH_SIZE);
+    if (fd == -1 || write(fd, input, BENCH_SIZE) != BENCH_SIZE) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return 1;
+    }
+    close(fd);
+    
+    const char *names[] = { "scan.getline", "scan.mmap_scalar", "scan.mmap_simd",
+                            "scan.mem_scalar", "scan.mem_simd" };
+    size_t expect = runGetline(path);
+    
+    for (int b = 0; b < 5; b++) {
+        double best = 1e9;
+        for (int r = 0; r < BENCH_RUNS; r++) {
+            double start = benchNow();
+            size_t lines = 0;
+            switch (b) {
+                case 0: lines = runGetline(path); break;
+                case 1: lines = runMapScan(path, 0); break;
+                case 2: lines = runMapScan(path, 1); break;
+                case 3: lines = runScan(input, 0); break;
+                case 4: lines = runScan(input, 1); break;
+            }
+            double t = benchNow() - start;
+            if (lines != expect) {
+                fprintf(stderr, "%s: %zu lines, expected %zu\n", names[b], lines, expect);
+                return 1;
+            }
+            if (t < best) best = t;
+        }
+        benchReport(names[b], BENCH_SIZE / best / 1e6, "MB/s");
+    }
+    
+    benchReport("scan.lines", expect, "lines");
+    unlink(path);
+    free(input);
+    return 0;
+}
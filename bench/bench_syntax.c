@@ -0,0 +1,78 @@
+#include "bench.h"
+#include <glob.h>
+
+// Highlights the C sources of the editor itself, repeated to BENCH_SYNTAX_SIZE
+// bytes, line by line as editorDrawRows would.
+
+#define BENCH_SYNTAX_SIZE (16 * 1024 * 1024)
+#define BENCH_RUNS 5
+
+// Read the sources into one buffer with every line NUL-terminated
+static char *loadSources(size_t *len) {
+    glob_t g;
+    size_t cap = BENCH_SYNTAX_SIZE + 64 * 1024;
+    char *buf = malloc(cap);
+    
+    *len = 0;
+    if (glob("src/*.[ch]", 0, NULL, &g) != 0) {
+        free(buf);
+        return NULL;
+    }
+    
+    while (*len < BENCH_SYNTAX_SIZE) {
+        for (size_t i = 0; i < g.gl_pathc && *len < BENCH_SYNTAX_SIZE; i++) {
+            FILE *fp = fopen(g.gl_pathv[i], "r");
+            if (!fp) continue;
+            *len += fread(&buf[*len], 1, cap - *len - 1, fp);
+            fclose(fp);
+        }
+    }
+    globfree(&g);
+    
+    for (size_t i = 0; i < *len; i++)
+        if (buf[i] == '\n') buf[i] = '\0';
+    return buf;
+}
+
+int benchSyntax() {
+    size_t len;
+    char *src = loadSources(&len);
+    if (!src) {
+        fprintf(stderr, "syntax: no sources under src/, run from the top directory\n");
+        return 1;
+    }
+    
+    E.filename = "bench.c";
+    editorSelectSyntaxHighlight();
+    
+    unsigned char *hl = malloc(len);
+    double best = 1e9;
+    size_t lines = 0;
+    
+    for (int r = 0; r < BENCH_RUNS; r++) {
+        erow row;
+        memset(&row, 0, sizeof(row));
+        row.hl_in = 0;
+        lines = 0;
+        
+        double start = benchNow();
+        for (size_t i = 0; i < len; i += row.rsize + 1) {
+            row.render = &src[i];
+            row.rsize = strlen(row.render);
+            row.hl = &hl[i];
+            editorUpdateSyntax(&row);
+            row.hl_in = row.hl_open_comment;
+            lines++;
+        }
+        double t = benchNow() - start;
+        if (t < best) best = t;
+    }
+    
+    benchReport("syntax.c_sources", len / best / 1e6, "MB/s");
+    benchReport("syntax.lines", lines, "lines");
+    E.filename = NULL;
+    E.syntax = NULL;
+    free(hl);
+    free(src);
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include "axcode.h"
+
+// The library API, for programs that keep documents in AxCode buffers
+// without the terminal. Every call names the buffer it works on and binds
+// it to the calling thread for as long as the call runs, so buffers can be
+// used on different threads at the same time, each by one thread at a
+// time. Rows are counted from 0. Text and highlighting handed out stay
+// good until the buffer is next changed.
+
+// Programs see only a pointer to it (see axcode_api.h)
+struct axBuffer {
+    struct editorConfig e;
+};
+
+axBuffer *axNew() {
+    axBuffer *b = malloc(sizeof(*b));
+    editorContextInit(&b->e);
+    return b;
+}
+
+void axFree(axBuffer *b) {
+    editorContextFree(&b->e);
+    free(b);
+}
+
+// Journal the unsaved edits of b for recovery, which is off unless set
+// before a file is opened
+void axJournal(axBuffer *b, int on) {
+    b->e.journalling = on;
+}
+
+// Have ask answer the questions opening a file raises, such as whether to
+// recover the edits found in its journal. Without it they are recovered.
+void axAsk(axBuffer *b, int (*ask)(const char *question)) {
+    b->e.ask = ask;
+}
+
+// Read filename into b in place of what it held. Returns 0 if it was read;
+// -1 if it could not be, axMessage() saying why.
+int axOpen(axBuffer *b, const char *filename) {
+    struct editorConfig *prev = editorBind(&b->e);
+    int ret = editorOpen((char *)filename);
+    editorBind(prev);
+    return ret;
+}
+
+// Write b to filename, or to the file it was read from if filename is
+// NULL, and wait for the write to finish. Returns 0 if it was written.
+int axSave(axBuffer *b, const char *filename) {
+    struct editorConfig *prev = editorBind(&b->e);
+    
+    if (filename) {
+        free(E.filename);
+        E.filename = strdup(filename);
+        editorSelectSyntaxHighlight();
+    }
+    editorSave();
+    editorSaveWait();
+    int ret = E.filename && E.save_error == 0 ? 0 : -1;
+    editorBind(prev);
+    return ret;
+}
+
+// What the last call that had something to say about b said
+const char *axMessage(axBuffer *b) {
+    return b->e.statusmsg;
+}
+
+int axRows(axBuffer *b) {
+    return b->e.numrows;
+}
+
+// b was changed since it was last read or written
+int axDirty(axBuffer *b) {
+    return b->e.dirty != 0;
+}
+
+// Text of row at, which is not terminated; NULL if there is no such row
+const char *axRowText(axBuffer *b, int at, int *len) {
+    if (at < 0 || at >= b->e.numrows) return NULL;
+    
+    struct editorConfig *prev = editorBind(&b->e);
+    erow *row = editorRowAt(at);
+    const char *text = row->cap ? editorRowChars(row) : row->chars;
+    *len = row->size;
+    editorBind(prev);
+    return text;
+}
+
+// Highlighting of row at, one editorColors value per byte of its text.
+// Only the rows from the last one highlighted before it are lexed.
+const unsigned char *axRowHighlight(axBuffer *b, int at, int *len) {
+    if (at < 0 || at >= b->e.numrows) return NULL;
+    
+    struct editorConfig *prev = editorBind(&b->e);
+    int state = editorSyntaxStateAt(at);
+    erow *row = editorRowAt(at);
+    if (!row->render || row->hl_in != state) {
+        row->hl_in = state;
+        editorUpdateRow(row);
+    }
+    editorRowRenderUpTo(row, row->rsize);
+    *len = row->rsize;
+    editorBind(prev);
+    return row->hl;
+}
+
+// Every edit is a step of its own for axUndo() and axRedo()
+
+// Insert the lines of s, separated by '\n', as rows from at on. Returns the
+// number of rows inserted.
+int axInsertRows(axBuffer *b, int at, const char *s, size_t len) {
+    struct editorConfig *prev = editorBind(&b->e);
+    editorUndoBreak();
+    int n = editorInsertRows(at, s, len);
+    editorBind(prev);
+    return n;
+}
+
+void axDeleteRows(axBuffer *b, int at, int n) {
+    struct editorConfig *prev = editorBind(&b->e);
+    editorUndoBreak();
+    editorDelRows(at, n);
+    editorBind(prev);
+}
+
+// Insert s, which holds no line break, into row at column col
+void axInsertText(axBuffer *b, int at, int col, const char *s, size_t len) {
+    if (at < 0 || at >= b->e.numrows) return;
+    
+    struct editorConfig *prev = editorBind(&b->e);
+    editorUndoBreak();
+    editorRowInsertString(editorRowAt(at), col, s, len);
+    editorBind(prev);
+}
+
+void axDeleteText(axBuffer *b, int at, int col, int len) {
+    if (at < 0 || at >= b->e.numrows) return;
+    
+    struct editorConfig *prev = editorBind(&b->e);
+    editorUndoBreak();
+    editorRowDelString(editorRowAt(at), col, len);
+    editorBind(prev);
+}
+
+void axUndo(axBuffer *b) {
+    struct editorConfig *prev = editorBind(&b->e);
+    editorUndo();
+    editorBind(prev);
+}
+
+void axRedo(axBuffer *b) {
+    struct editorConfig *prev = editorBind(&b->e);
+    editorRedo();
+    editorBind(prev);
+}
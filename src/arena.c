@@ -0,0 +1,72 @@
+#include "axcode.h"
+
+// A bump allocator over a list of slabs. Everything allocated from an
+// arena is released at once by arenaFree(); nothing is freed on its own.
+#define ARENA_SLAB (1024 * 1024)
+#define ARENA_SLAB_MAX (64 * 1024 * 1024)
+#define ARENA_ALIGN 8
+
+struct arenaSlab {
+    struct arenaSlab *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+static struct arenaSlab *slabNew(arena *a, size_t size) {
+    struct arenaSlab *slab = malloc(sizeof(struct arenaSlab) + size);
+    if (!slab) return NULL;
+    
+    slab->next = NULL;
+    slab->used = 0;
+    slab->size = size;
+    a->bytes += size;
+    return slab;
+}
+
+void *arenaAlloc(arena *a, size_t size) {
+    struct arenaSlab *slab = a->slabs;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    
+    // Big blocks get a slab of their own, kept behind the current one so
+    // that small allocations go on filling it
+    if (size > ARENA_SLAB / 4) {
+        struct arenaSlab *big = slabNew(a, size);
+        if (!big) return NULL;
+        big->used = size;
+        if (slab) {
+            big->next = slab->next;
+            slab->next = big;
+        } else {
+            a->slabs = big;
+        }
+        return big->data;
+    }
+    
+    if (!slab || slab->size - slab->used < size) {
+        // Regular slabs double in size, so big loads only need a few
+        size_t want = a->next ? a->next : ARENA_SLAB;
+        a->next = want < ARENA_SLAB_MAX ? want * 2 : want;
+        
+        struct arenaSlab *fresh = slabNew(a, want);
+        if (!fresh) return NULL;
+        fresh->next = slab;
+        a->slabs = slab = fresh;
+    }
+    
+    void *p = &slab->data[slab->used];
+    slab->used += size;
+    return p;
+}
+
+void arenaFree(arena *a) {
+    struct arenaSlab *slab = a->slabs;
+    while (slab) {
+        struct arenaSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    a->slabs = NULL;
+    a->next = 0;
+    a->bytes = 0;
+}
@@ -7,12 +7,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ncurses.h>
+#include <limits.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <poll.h>
+
+#include "axcode_api.h"
 
 #define CTRL_KEY(k) ((k) & 0x1f)
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
@@ -20,21 +30,39 @@
 #define HL_HIGHLIGHT_MULTILINE_COMMENT (1<<2)
 #define VERSION "0.1"
 
-// Define color pairs
-enum editorColors {
-    COLOR_DEFAULT = 1,
-    COLOR_COMMENT,
-    COLOR_KEYWORD,
-    COLOR_TYPE,      // For type keywords like "var", "fun", etc.
-    COLOR_CONTROL,   // For control flow keywords
-    COLOR_NUMBER,
-    COLOR_STRING,
-    COLOR_MATCH,
-    COLOR_BOOLEAN,   // For boolean values (true/false)
-    COLOR_OPERATOR,  // For operators
-    COLOR_STATUS,
-    COLOR_STATUS_MSG,
-    COLOR_LINE_NUMBER
+// Files at least this big are mapped and their rows loaded on demand
+#define MMAP_THRESHOLD (16 * 1024 * 1024)
+#define ROWTREE_MAXDEPTH 16
+#define LINEINDEX_BLOCK 1024
+// Offset in a line index standing for a line whose start is kept in full
+#define LINEINDEX_WIDE UINT32_MAX
+
+// Longest time keys are applied in one batch before the screen is painted
+#define INPUT_LATENCY_MAX_MS 16
+// How often a save running in the background is checked on
+#define SAVE_POLL_MS 100
+// Memory the undo history may hold unless set with :set undobudget
+#define UNDO_BUDGET (64 * 1024 * 1024)
+// The recovery journal is written out once this much is waiting, or once
+// the oldest edit waiting is this old
+#define JOURNAL_FLUSH_BYTES (64 * 1024)
+#define JOURNAL_FLUSH_MS 1000
+// Most of a followed file read and added as rows at once
+#define FOLLOW_BATCH (4 * 1024 * 1024)
+// Memory the buffers not being edited may hold unless set with
+// :set bufferbudget; past it the least recently visited are dropped
+#define BUFFER_BUDGET (256 * 1024 * 1024)
+// Latest times of each kind :stats works its percentiles out from
+#define STATS_SAMPLES 4096
+// Bytes of a long row an edit is lexed again within: lexing starts at most
+// about this far before the edit, and render and hl are kept in one piece
+// for twice this after it
+#define HL_EDIT_WINDOW 1024
+
+// Kinds of edits kept in the undo history
+enum undoType {
+    UNDO_INSERT,
+    UNDO_DELETE
 };
 
 // Editor modes
@@ -59,14 +87,82 @@ struct editorSyntax {
 };
 
 typedef struct erow {
-    int size;
-    char *chars;
+    int size;           // Length of the row text
+    int gap;            // Offset of the gap in chars
+    char *chars;        // Gap buffer holding the row text
+    int cap;            // Allocated size of chars, 0 if chars points into E.text
     int rsize;
-    char *render;
-    unsigned char *hl;  // Highlight array
+    int rgap;           // Offset of the gap in render and hl
+    int rcap;           // Allocated size of render and hl
+    char *render;       // Gap buffer like chars, see editorRowRenderUpTo()
+    unsigned char *hl;  // Highlight array, with the same gap as render
+    int hl_in;          // Lexer state hl was computed from, -1 if out of date
     int hl_open_comment; // Flag for open multiline comments
+    struct rowNode *leaf; // Row tree leaf holding the row
 } erow;
 
+// A place in a row the lexer can start from again, with the state it is
+// in there (see syntax.c)
+typedef struct hlMark {
+    int at;
+    int state;
+} hlMark;
+
+typedef struct hlMarks {
+    hlMark *marks;
+    int n, cap;
+} hlMarks;
+
+struct rowNode;
+struct arenaSlab;
+struct keywordEntry;
+struct undoHistory;
+struct journalState;
+struct saveJob;
+struct editorStats;
+
+// Bump allocator whose memory is released all at once (see arena.c)
+typedef struct arena {
+    struct arenaSlab *slabs; // Slabs, the one being filled first
+    size_t next;             // Size of the next regular slab
+    size_t bytes;            // Total size of all slabs
+} arena;
+
+// A line starting too far past its block for a 32-bit offset
+typedef struct lineWide {
+    size_t line;
+    size_t start;
+} lineWide;
+
+// Where every line of a buffer starts (see scan.c)
+typedef struct lineIndex {
+    size_t nlines;      // Number of lines
+    size_t cap;         // Allocated entries in rel
+    size_t end;         // Length of the scanned buffer
+    uint32_t *rel;      // Line start relative to the first line of its block
+    size_t *base;       // Start of the first line of every LINEINDEX_BLOCK lines
+    lineWide *wide;     // Lines whose rel is LINEINDEX_WIDE, in order
+    size_t nwide, widecap;
+} lineIndex;
+
+// Keywords of a syntax compiled into a perfect hash (see keyword.c)
+typedef struct keywordTable {
+    int size;           // Number of slots, a power of two
+    int nbuckets;       // Number of displacement buckets, a power of two
+    int maxlen;         // Length of the longest keyword
+    uint32_t *disp;     // Displacement of every bucket
+    struct keywordEntry *slots;
+} keywordTable;
+
+// In-order walk over the rows without loading unloaded leaves
+typedef struct rowIter {
+    struct rowNode *path[ROWTREE_MAXDEPTH];
+    int idx[ROWTREE_MAXDEPTH];
+    int depth;
+    int loaded_only;    // Skip rows that have not been loaded yet
+    erow tmp;           // Scratch row handed out for rows that are not loaded
+} rowIter;
+
 struct editorConfig {
     int cx, cy;         // Cursor position
     int rx;             // Render position (for tabs)
@@ -75,57 +171,222 @@ struct editorConfig {
     int screenrows;     // Number of rows visible in the terminal
     int screencols;     // Number of columns visible in the terminal
     int numrows;        // Number of rows in the file
-    erow *row;          // Array of rows
+    struct rowNode *row; // Balanced tree of rows (see rowtree.c)
     char *filename;     // Current filename
+    char *text;         // Contents of the file as loaded; rows are made from it
+    size_t textsize;    // Length of text
+    int mapped;         // text is an mmap of the file rather than in arena
+    lineIndex lines;    // Line index of text
+    arena arena;        // Memory of the loaded file, released when it is closed
+    size_t rowbytes;    // Heap the rows and tree nodes hold outside arena
     char statusmsg[80]; // Status message
     time_t statusmsg_time; // Time when the status message was set
     int mode;           // Editor mode
-    WINDOW *win;        // ncurses window
     int dirty;          // Flag to indicate if file has been modified
+    unsigned long changes; // Number of edits made so far
     int showLineNumbers; // Flag to show line numbers
+    size_t undo_budget; // Memory the undo history may hold
+    size_t buffer_budget; // Memory the other buffers may hold
     struct editorSyntax *syntax; // Current syntax highlight
+    int hl_stale;       // First row whose incoming lexer state may be out of date
+    int hl_resume;      // Row above hl_stale the lexer state was last worked out at,
+    int hl_resume_state; // that state,
+    unsigned long hl_resume_changes; // and E.changes then; no good once it changed
+    char *lex_text;     // Scratch copy of a row lexed only for its state
+    unsigned char *lex_hl; // and the highlighting it is lexed into
+    int lex_cap;        // Allocated size of both
+    hlMarks hl_marks;   // Places to lex hl_marks_row from after an edit,
+    erow *hl_marks_row; // the long row last typed into,
+    unsigned long hl_marks_changes; // as of E.changes then
+    hlMarks hl_lexed;   // Places found lexing the row again after an edit
+    int redraw;         // Whole screen must be redrawn
+    int damage_from, damage_to; // Rows to redraw, none if from > to
+    char *search;       // Pattern being searched for, NULL if none
+    int searchlen;
+    struct undoHistory *undo; // Undo and redo history (see undo.c)
+    struct journalState *journal; // Recovery journal (see journal.c)
+    int journalling;    // Unsaved edits are journalled
+    struct saveJob *saving; // Save running in the background, if any
+    int save_error;     // errno of the last save if it failed, else 0
+    struct editorStats *stats; // Timings being collected, NULL if not (see stats.c)
+    int (*ask)(const char *question); // Asks the user a yes or no question, NULL if no one can be asked
+    int (*keytyped)();  // Whether a key was typed that long work should stop for, NULL if none can be
 };
 
-// Global editor state
-extern struct editorConfig E;
+// E is the buffer the calling thread works on: the terminal's own unless
+// the thread bound another one with editorBind() (see context.c)
+extern __thread struct editorConfig *editorCurrent;
+#define E (*editorCurrent)
 
 // Function prototypes
 
-// Editor operations
-void initEditor();
+// Buffer contexts
+void editorContextInit(struct editorConfig *e);
+void editorContextFree(struct editorConfig *e);
+struct editorConfig *editorBind(struct editorConfig *e);
 void editorSetStatusMessage(const char *fmt, ...);
+void editorDamageRows(int from, int to);
+void editorDamageScreen();
+
+// Editor operations (terminal frontend)
+void initEditor();
 void editorRefreshScreen();
 void editorProcessKeypress();
+int editorReadKey();
+int editorPendingKey();
 void editorMoveCursor(int key);
 void editorScroll();
 void editorProcessCommand(char *command);
 
-// Display functions
+// Display functions (terminal frontend)
 void editorDrawRows();
 void editorDrawStatusBar();
 
 // File operations
-void editorOpen(char *filename);
+int editorOpen(char *filename);
+void editorCloseFile();
 void editorSave();
-char *editorPrompt(char *prompt);
+void editorSaveWait();
+int editorSavePoll();
+int editorSaving();
+void editorMapRow(erow *row, int line);
+void editorSyncDir(const char *path);
+
+// Buffer list (terminal frontend)
+int editorBufferAdd(const char *filename);
+void editorBufferSwitch(int i);
+void editorBufferEdit(const char *filename);
+void editorBufferNext(int dir);
+void editorBufferList();
+const char *editorBufferModified();
+void editorBufferCloseJournals();
+
+// Latency and memory stats
+uint64_t editorStatsNow();
+void editorStatsStart();
+void editorStatsStop();
+uint64_t editorStatsFrameStart();
+void editorStatsFrameEnd(uint64_t start, uint64_t drawn);
+void editorStatsKey();
+void editorStatsHighlight(uint64_t ns);
+void editorStatsShow();
+int editorStatsWrite(const char *path);
+void editorStatsDumpOnExit(const char *path);
+
+// Following a growing file (terminal frontend)
+void editorFollowStart();
+void editorFollowStop();
+int editorFollowing();
+int editorFollowWait(int ms);
+void editorFollowUpdate();
 
 // Row operations
 void editorUpdateRow(erow *row);
 void editorInsertRow(int at, char *s, size_t len);
+int editorInsertRows(int at, const char *s, size_t len);
+void editorAppendFileRows(const char *s, size_t len, int join);
 void editorAppendRow(char *s, size_t len);
 void editorFreeRow(erow *row);
 void editorDelRow(int at);
+void editorDelRows(int at, int n);
+void editorRowInsertString(erow *row, int at, const char *s, size_t len);
 void editorRowInsertChar(erow *row, int at, int c);
 void editorRowAppendString(erow *row, char *s, size_t len);
+void editorRowDelString(erow *row, int at, int len);
 void editorRowDelChar(erow *row, int at);
+void editorRowTruncate(erow *row, int len);
+void editorRowSetText(erow *row, const char *s, size_t len);
+char *editorRowChars(erow *row);
+void editorRowRenderUpTo(erow *row, int end);
+
+// Arena allocation
+void *arenaAlloc(arena *a, size_t size);
+void arenaFree(arena *a);
+
+// Line scanning
+void editorScanLines(lineIndex *idx, const char *buf, size_t len, int simd);
+size_t editorLineStart(lineIndex *idx, size_t line);
+size_t editorLineSpan(lineIndex *idx, const char *buf, size_t line, size_t *len);
+size_t editorLineOf(lineIndex *idx, size_t off);
+void editorLineIndexFree(lineIndex *idx);
+
+// Row tree
+erow *editorRowAt(int at);
+void editorRowTreeInsert(int at, erow *row);
+void editorRowTreeRemove(int at);
+void editorRowTreeClear();
+void editorRowTreeLoadLines(int nlines);
+int editorRowIndex(erow *row);
+int editorRowTreeCheckpoint(int at, int *start);
+void editorRowIterInit(rowIter *it, int at, int loaded_only);
+erow *editorRowIterNext(rowIter *it);
+int editorRowIterLines(rowIter *it, int max, size_t *line);
+void editorRowIterCheckpoint(rowIter *it, int state);
 
-// Editor actions
+// Editor actions (terminal frontend)
 void editorInsertChar(int c);
+void editorInsertText(const char *s, size_t len);
 void editorInsertNewline();
 void editorDeleteChar();
 
+// Undo history
+void editorUndoRecord(int type, int rows, int row, int col, const char *text, size_t len);
+int editorUndoRecording();
+void editorUndoBreak();
+void editorUndo();
+void editorRedo();
+void editorUndoClear();
+void editorUndoFree();
+size_t editorUndoSize(const struct undoHistory *h);
+
+// Search (terminal frontend)
+void editorSearchBegin();
+void editorSearchUpdate(const char *pattern);
+void editorSearchEnd(int accept);
+void editorSearchNext(int dir);
+int editorSearchHighlight(erow *row, unsigned char *hl, int from, int len);
+const char *editorSearchMem(const char *s, size_t n, const char *p, size_t m);
+void editorSearchClear();
+
+// Substitute (terminal frontend)
+void editorSubstitute(const char *command);
+
+// Regular expressions
+typedef struct regex regex;
+typedef struct regexDFA regexDFA;
+regex *regexCompile(const char *pattern, const char **err);
+void regexFree(regex *re);
+int regexFind(regex *re, const char *s, int len, int from, int *mlen);
+regexDFA *regexDFANew(const regex *re);
+void regexDFAFree(regexDFA *d);
+void regexScan(regexDFA *d, const char *text, size_t len, size_t **lines, int *n, int *cap);
+
+// Recovery journal
+void editorJournalOpen(const char *filename);
+void editorJournalRecord(int type, int rows, int row, int col, const char *text, size_t len);
+void editorJournalFlush();
+int editorJournalPending();
+uint64_t editorJournalMark();
+void editorJournalSaved(uint64_t mark, const char *filename);
+void editorJournalClose();
+void editorJournalFree();
+
+// Keyword lookup
+void keywordCompile(keywordTable *t, struct editorSyntax *syntax);
+int keywordFind(keywordTable *t, const char *s, int len);
+
 // Syntax highlighting
 void editorUpdateSyntax(erow *row);
+void editorSyntaxRowEdit(erow *row, int at, int len);
 void editorSelectSyntaxHighlight();
+int editorSyntaxStateAt(int at);
+void editorSyntaxInvalidate(int at);
+void editorSyntaxPropagate(int at, int old, int new);
+void editorSyntaxRowChanged(erow *row, int out);
+void editorSyntaxInsertRow(int at);
+void editorSyntaxDelRow(int at);
+void editorSyntaxStartWorker();
+void editorSyntaxResume();
+void editorSyntaxPause();
 
 #endif /* AXCODE_H */
\ No newline at end of file
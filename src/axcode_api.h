@@ -0,0 +1,56 @@
+#ifndef AXCODE_API_H
+#define AXCODE_API_H
+
+#include <stddef.h>
+
+// The library API of AxCode (see api.c), the only header a program using
+// the library includes. Everything else lives in axcode.h, which is private
+// to the editor.
+//
+// Threads: every call works on the buffer it is given and nothing else, so
+// different buffers may be used on different threads at the same time,
+// saves included. Calls on one buffer must not overlap: a buffer is used
+// by one thread at a time, and text or highlighting handed out stays good
+// only until the next call that changes it. Two buffers should not hold
+// the same file, as they would share its journal and overwrite each
+// other's saves.
+
+// A document, with its rows, its file and its undo history
+typedef struct axBuffer axBuffer;
+
+// Colors axRowHighlight() hands out, one per byte of a row
+enum editorColors {
+    COLOR_DEFAULT = 1,
+    COLOR_COMMENT,
+    COLOR_KEYWORD,
+    COLOR_TYPE,      // For type keywords like "var", "fun", etc.
+    COLOR_CONTROL,   // For control flow keywords
+    COLOR_NUMBER,
+    COLOR_STRING,
+    COLOR_MATCH,
+    COLOR_BOOLEAN,   // For boolean values (true/false)
+    COLOR_OPERATOR,  // For operators
+    COLOR_STATUS,
+    COLOR_STATUS_MSG,
+    COLOR_LINE_NUMBER
+};
+
+axBuffer *axNew();
+void axFree(axBuffer *b);
+void axJournal(axBuffer *b, int on);
+void axAsk(axBuffer *b, int (*ask)(const char *question));
+int axOpen(axBuffer *b, const char *filename);
+int axSave(axBuffer *b, const char *filename);
+const char *axMessage(axBuffer *b);
+int axRows(axBuffer *b);
+int axDirty(axBuffer *b);
+const char *axRowText(axBuffer *b, int at, int *len);
+const unsigned char *axRowHighlight(axBuffer *b, int at, int *len);
+int axInsertRows(axBuffer *b, int at, const char *s, size_t len);
+void axDeleteRows(axBuffer *b, int at, int n);
+void axInsertText(axBuffer *b, int at, int col, const char *s, size_t len);
+void axDeleteText(axBuffer *b, int at, int col, int len);
+void axUndo(axBuffer *b);
+void axRedo(axBuffer *b);
+
+#endif /* AXCODE_API_H */
@@ -0,0 +1,284 @@
+#include "axcode.h"
+
+// The list of files being edited. Only the current buffer lives in E; the
+// others keep the fields of E that belong to their file, their undo history
+// and their journal here, rows and highlighting included, so switching back
+// to one costs no more than moving those fields back. Files named on the
+// command line are only read when they are first visited. Once the buffers
+// not being edited hold more than E.buffer_budget, those visited least
+// recently have their rows dropped and are read from the file again when
+// visited next; buffers with unsaved changes are always kept.
+struct buffer {
+    struct editorConfig e;  // The fields of E of the file while not current
+    int loaded;             // The file was read; else only e.filename is set
+    unsigned long visited;  // When it was last left, to drop the oldest first
+};
+
+static struct buffer *buffers;
+static int nbuffers, bufferCap;
+static int current;             // Index of the buffer in E
+static unsigned long visits;
+
+// Move the fields that belong to the file from one config to another,
+// leaving from without a file
+static void bufferMove(struct editorConfig *to, struct editorConfig *from) {
+    to->cx = from->cx;
+    to->cy = from->cy;
+    to->rx = from->rx;
+    to->rowoff = from->rowoff;
+    to->coloff = from->coloff;
+    to->numrows = from->numrows;
+    to->row = from->row;
+    to->filename = from->filename;
+    to->text = from->text;
+    to->textsize = from->textsize;
+    to->mapped = from->mapped;
+    to->lines = from->lines;
+    to->arena = from->arena;
+    to->rowbytes = from->rowbytes;
+    to->dirty = from->dirty;
+    to->syntax = from->syntax;
+    to->hl_stale = from->hl_stale;
+    to->hl_resume = from->hl_resume;
+    to->hl_resume_state = from->hl_resume_state;
+    to->hl_resume_changes = from->hl_resume_changes;
+    to->undo = from->undo;
+    to->journal = from->journal;
+    
+    from->cx = from->cy = from->rx = 0;
+    from->rowoff = from->coloff = 0;
+    from->numrows = 0;
+    from->row = NULL;
+    from->filename = NULL;
+    from->text = NULL;
+    from->textsize = 0;
+    from->mapped = 0;
+    memset(&from->lines, 0, sizeof(from->lines));
+    memset(&from->arena, 0, sizeof(from->arena));
+    from->rowbytes = 0;
+    from->dirty = 0;
+    from->syntax = NULL;
+    from->hl_stale = 1;
+    from->hl_resume = 0;
+    to->hl_marks_row = NULL;
+    from->undo = NULL;
+    from->journal = NULL;
+}
+
+// The buffer in E is the first one
+static void bufferInit() {
+    if (nbuffers > 0) return;
+    
+    bufferCap = 8;
+    buffers = calloc(bufferCap, sizeof(struct buffer));
+    buffers[0].loaded = 1;
+    nbuffers = 1;
+}
+
+static const char *bufferName(int i) {
+    return i == current ? E.filename : buffers[i].e.filename;
+}
+
+static int bufferDirty(int i) {
+    return i == current ? E.dirty : buffers[i].e.dirty;
+}
+
+// Put the current buffer away, leaving E without a file
+static void bufferStash(struct buffer *b) {
+    // A save may still be writing the rows
+    editorSaveWait();
+    editorSearchClear();
+    editorFollowStop();
+    editorUndoBreak();
+    editorJournalFlush();
+    bufferMove(&b->e, &E);
+    b->visited = ++visits;
+}
+
+static void bufferRestore(struct buffer *b) {
+    // E may have made an empty history and journal of its own meanwhile
+    editorUndoFree();
+    editorJournalFree();
+    bufferMove(&E, &b->e);
+}
+
+// Free the rows of a buffer that was put away, keeping its name and where
+// the cursor was
+static void bufferDrop(struct buffer *b) {
+    bufferRestore(b);
+    editorCloseFile();
+    bufferMove(&b->e, &E);
+    b->loaded = 0;
+}
+
+// Memory a buffer put away holds: the slabs of its loaded file, in which
+// its row tree is built, what its rows took from the heap since and its
+// undo history
+static size_t bufferSize(struct buffer *b) {
+    if (!b->loaded) return 0;
+    return b->e.arena.bytes + b->e.rowbytes + editorUndoSize(b->e.undo);
+}
+
+// Drop the least recently visited buffers without unsaved changes, other
+// than buffer keep, until the buffers put away fit E.buffer_budget
+static void bufferTrim(int keep) {
+    size_t total = 0;
+    
+    for (int i = 0; i < nbuffers; i++)
+        if (i != current) total += bufferSize(&buffers[i]);
+    
+    while (total > E.buffer_budget) {
+        struct buffer *oldest = NULL;
+        for (int i = 0; i < nbuffers; i++) {
+            struct buffer *b = &buffers[i];
+            if (i == current || i == keep || !b->loaded || b->e.dirty || bufferSize(b) == 0) continue;
+            if (!oldest || b->visited < oldest->visited) oldest = b;
+        }
+        if (!oldest) break;
+        
+        total -= bufferSize(oldest);
+        bufferDrop(oldest);
+    }
+}
+
+// The directory of path resolved into dir, which holds PATH_MAX bytes.
+// Returns the last part of path, or NULL if the directory does not exist.
+static const char *bufferDir(const char *path, char *dir) {
+    const char *slash = strrchr(path, '/');
+    if (!slash) return realpath(".", dir) ? path : NULL;
+    
+    char *parent = strndup(path, slash == path ? 1 : (size_t)(slash - path));
+    const char *base = parent && realpath(parent, dir) ? slash + 1 : NULL;
+    free(parent);
+    return base;
+}
+
+// Whether two names lead to the same file, however they are written and
+// through whatever links: the same inode while it exists, else the same
+// name in the same directory
+static int bufferSameFile(const char *a, const char *b) {
+    if (strcmp(a, b) == 0) return 1;
+    
+    struct stat sa, sb;
+    int ha = stat(a, &sa) == 0, hb = stat(b, &sb) == 0;
+    if (ha || hb) return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+    
+    char da[PATH_MAX], db[PATH_MAX];
+    const char *na = bufferDir(a, da), *nb = bufferDir(b, db);
+    return na && nb && strcmp(na, nb) == 0 && strcmp(da, db) == 0;
+}
+
+// Add a buffer for filename, read when it is first visited, unless there is
+// one for the same file already. Returns its index.
+int editorBufferAdd(const char *filename) {
+    bufferInit();
+    for (int i = 0; i < nbuffers; i++) {
+        const char *name = bufferName(i);
+        if (name && bufferSameFile(name, filename)) return i;
+    }
+    
+    if (nbuffers == bufferCap) {
+        bufferCap *= 2;
+        buffers = realloc(buffers, sizeof(struct buffer) * bufferCap);
+    }
+    struct buffer *b = &buffers[nbuffers];
+    memset(b, 0, sizeof(*b));
+    b->e.filename = strdup(filename);
+    return nbuffers++;
+}
+
+// Make buffer i the current one, reading its file if it is not loaded
+void editorBufferSwitch(int i) {
+    bufferInit();
+    if (i == current || i < 0 || i >= nbuffers) return;
+    
+    // An empty buffer without a name, as the editor starts with, has never
+    // been edited and is not worth keeping
+    if (!E.filename && E.numrows == 0 && !E.dirty) {
+        editorSearchClear();
+        memmove(&buffers[current], &buffers[current + 1], sizeof(struct buffer) * (nbuffers - current - 1));
+        nbuffers--;
+        if (i > current) i--;
+    } else {
+        bufferStash(&buffers[current]);
+    }
+    
+    current = i;
+    bufferTrim(i);
+    
+    struct buffer *b = &buffers[i];
+    if (b->loaded) {
+        bufferRestore(b);
+        editorDamageScreen();
+        return;
+    }
+    
+    char *filename = b->e.filename;
+    int cy = b->e.cy;
+    b->e.filename = NULL;
+    b->loaded = 1;
+    editorOpen(filename);
+    free(filename);
+    if (cy < E.numrows) E.cy = cy;
+}
+
+// Switch to buffer i and say which file it is, unless reading the file had
+// something to say
+static void bufferGo(int i) {
+    E.statusmsg[0] = '\0';
+    editorBufferSwitch(i);
+    if (E.statusmsg[0]) return;
+    
+    editorSetStatusMessage("\"%s\" %d line%s%s", E.filename ? E.filename : "[No Name]",
+                           E.numrows, E.numrows == 1 ? "" : "s", E.dirty ? " [+]" : "");
+}
+
+// :e filename
+void editorBufferEdit(const char *filename) {
+    bufferGo(editorBufferAdd(filename));
+}
+
+// :bn and :bp
+void editorBufferNext(int dir) {
+    bufferInit();
+    bufferGo((current + dir + nbuffers) % nbuffers);
+}
+
+// :ls shows every buffer's number and file, % marking the current one and
+// + those with unsaved changes
+void editorBufferList() {
+    char list[sizeof(E.statusmsg)];
+    size_t len = 0;
+    
+    bufferInit();
+    list[0] = '\0';
+    for (int i = 0; i < nbuffers && len < sizeof(list); i++) {
+        const char *name = bufferName(i);
+        len += snprintf(&list[len], sizeof(list) - len, "%s%s%d %s%s", i ? "  " : "", i == current ? "%" : "",
+                        i + 1, name ? name : "[No Name]", bufferDirty(i) ? "+" : "");
+    }
+    editorSetStatusMessage("%s", list);
+}
+
+// The name of a buffer other than the current one with unsaved changes, or
+// NULL if there is none
+const char *editorBufferModified() {
+    for (int i = 0; i < nbuffers; i++) {
+        if (i != current && bufferDirty(i)) {
+            const char *name = bufferName(i);
+            return name ? name : "[No Name]";
+        }
+    }
+    return NULL;
+}
+
+// Remove the journals of all buffers, as quitting does
+void editorBufferCloseJournals() {
+    editorJournalClose();
+    for (int i = 0; i < nbuffers; i++) {
+        if (i == current || !buffers[i].e.journal) continue;
+        struct editorConfig *prev = editorBind(&buffers[i].e);
+        editorJournalClose();
+        editorBind(prev);
+    }
+}
@@ -0,0 +1,76 @@
+#include "axcode.h"
+
+// A buffer is a struct editorConfig of its own, holding its rows, its file,
+// its undo history, its journal and its save in progress. The code works on
+// E, the buffer the calling thread is bound to, so buffers bound on
+// different threads are edited at the same time without sharing anything
+// but the compiled syntax tables. Every thread starts out bound to the
+// buffer of the terminal frontend.
+static struct editorConfig editorMain;
+__thread struct editorConfig *editorCurrent = &editorMain;
+
+// Make e an empty buffer without a file
+void editorContextInit(struct editorConfig *e) {
+    memset(e, 0, sizeof(*e));
+    e->mode = MODE_NORMAL;
+    e->showLineNumbers = 1;
+    e->undo_budget = UNDO_BUDGET;
+    e->buffer_budget = BUFFER_BUDGET;
+    e->hl_stale = 1;
+    e->redraw = 1;
+    e->damage_from = INT_MAX;
+    e->damage_to = -1;
+}
+
+// Close the file of e and free everything it holds, removing its journal
+void editorContextFree(struct editorConfig *e) {
+    struct editorConfig *prev = editorBind(e);
+    
+    editorCloseFile();
+    editorUndoFree();
+    editorJournalFree();
+    editorStatsStop();
+    free(E.filename);
+    free(E.search);
+    free(E.lex_text);
+    free(E.lex_hl);
+    free(E.hl_marks.marks);
+    free(E.hl_lexed.marks);
+    E.filename = NULL;
+    E.search = NULL;
+    E.lex_text = NULL;
+    E.lex_hl = NULL;
+    E.lex_cap = 0;
+    memset(&E.hl_marks, 0, sizeof(E.hl_marks));
+    memset(&E.hl_lexed, 0, sizeof(E.hl_lexed));
+    E.hl_marks_row = NULL;
+    editorBind(prev);
+}
+
+// Bind e to the calling thread, so that E is e from now on. Returns the
+// buffer bound before, to be bound again once the thread is done with e.
+struct editorConfig *editorBind(struct editorConfig *e) {
+    struct editorConfig *prev = editorCurrent;
+    editorCurrent = e;
+    return prev;
+}
+
+void editorSetStatusMessage(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
+    va_end(ap);
+    E.statusmsg_time = time(NULL);
+}
+
+// Row from..to of the file must be redrawn; rows keep their lines on screen
+// otherwise, so a keystroke only rewrites what it changed
+void editorDamageRows(int from, int to) {
+    if (from < E.damage_from) E.damage_from = from;
+    if (to > E.damage_to) E.damage_to = to;
+}
+
+// Everything must be redrawn, for instance when another file was opened
+void editorDamageScreen() {
+    E.redraw = 1;
+}
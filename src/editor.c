@@ -1,27 +1,60 @@
 #include "axcode.h"
+#include <ncurses.h>
 
-void initEditor() {
-    E.cx = 0;
-    E.cy = 0;
-    E.rx = 0;
-    E.rowoff = 0;
-    E.coloff = 0;
-    E.numrows = 0;
-    E.row = NULL;
-    E.filename = NULL;
-    E.statusmsg[0] = '\0';
-    E.mode = MODE_NORMAL;
-    E.dirty = 0;
-    E.showLineNumbers = 1; // Enable line numbers by default
-    E.syntax = NULL;
+// Terminals in bracketed paste mode wrap pasted text in these
+#define PASTE_ENABLE "\033[?2004h"
+#define PASTE_DISABLE "\033[?2004l"
+#define PASTE_START "\033[200~"
+#define PASTE_END "\033[201~"
+#define PASTE_TIMEOUT_MS 1000
+
+static void editorPasteOff() {
+    printf(PASTE_DISABLE);
+    fflush(stdout);
+}
+
+// The terminal's ncurses window
+static WINDOW *win;
+
+// Ask a yes or no question on the status line
+static int editorAskKey(const char *question) {
+    editorSetStatusMessage("%s", question);
+    editorRefreshScreen();
+    int c = editorReadKey();
+    return c == 'y' || c == 'Y';
+}
+
+// Whether a key was typed, which is put back to be read as usual
+static int editorKeyWaiting() {
+    int c = editorPendingKey();
+    if (c == ERR) return 0;
+    ungetch(c);
+    return 1;
+}
 
+void initEditor() {
+    editorContextInit(&E);
+    E.journalling = 1;
+    E.ask = editorAskKey;
+    E.keytyped = editorKeyWaiting;
+    
     // Initialize ncurses
-    E.win = initscr();
+    win = initscr();
     raw();
-    keypad(E.win, TRUE);
+    keypad(win, TRUE);
     noecho();
     start_color();
     
+    // Have pasted text marked so that it goes in as one edit
+    printf(PASTE_ENABLE);
+    fflush(stdout);
+    atexit(editorPasteOff);
+    
+    // Quitting removes the recovery journals, once a save still running
+    // has finished
+    atexit(editorBufferCloseJournals);
+    atexit(editorSaveWait);
+    
     // Set up color pairs
     init_pair(COLOR_DEFAULT, COLOR_WHITE, COLOR_BLACK);
     init_pair(COLOR_COMMENT, COLOR_BLUE, COLOR_BLACK);
@@ -38,27 +71,85 @@ void initEditor() {
     init_pair(COLOR_LINE_NUMBER, COLOR_BLACK, COLOR_WHITE);
     
     // Get terminal size
-    getmaxyx(E.win, E.screenrows, E.screencols);
+    getmaxyx(win, E.screenrows, E.screencols);
     E.screenrows -= 2; // Make room for status bar
 }
 
 // Display functions
+
+// Draw the visible part of a row as runs of one color each, with the
+// matches of the search on top of the syntax colors
+static void editorDrawRowText(int y, int x, erow *row, int len) {
+    editorRowRenderUpTo(row, E.coloff + len);
+    char *render = &row->render[E.coloff];
+    unsigned char hl[len];
+    
+    if (E.syntax && row->hl)
+        memcpy(hl, &row->hl[E.coloff], len);
+    else
+        memset(hl, 0, len);
+    
+    if (editorSearchHighlight(row, hl, E.coloff, len) == 0 && (!E.syntax || !row->hl)) {
+        mvwaddnstr(win, y, x, render, len);
+        return;
+    }
+    
+    wmove(win, y, x);
+    for (int j = 0; j < len; ) {
+        int start = j;
+        while (j < len && hl[j] == hl[start]) j++;
+        
+        wattron(win, COLOR_PAIR(hl[start]));
+        waddnstr(win, &render[start], j - start);
+        wattroff(win, COLOR_PAIR(hl[start]));
+    }
+}
+
 void editorDrawRows() {
+    static int drawn_rowoff = -1, drawn_coloff, drawn_width;
+    
+    // Width for line numbers: 4 digits + 1 space + 1 separator
+    int lineNumWidth = (E.showLineNumbers && E.numrows > 0) ? 6 : 0;
+    
+    // Scrolling moves every row to another line
+    if (E.rowoff != drawn_rowoff || E.coloff != drawn_coloff || lineNumWidth != drawn_width)
+        E.redraw = 1;
+    drawn_rowoff = E.rowoff;
+    drawn_coloff = E.coloff;
+    drawn_width = lineNumWidth;
+    
+    // Rows are highlighted as they come into view, starting from the lexer
+    // state the first of them begins in
+    int state = editorSyntaxStateAt(E.rowoff);
+    int spilled = 0;
     int y;
     for (y = 0; y < E.screenrows; y++) {
         int filerow = y + E.rowoff;
+        int damaged = E.redraw || spilled || (filerow >= E.damage_from && filerow <= E.damage_to);
+        erow *row = NULL;
+        
+        if (filerow < E.numrows) {
+            row = editorRowAt(filerow);
+            if (!row->render || row->hl_in != state) {
+                row->hl_in = state;
+                editorUpdateRow(row);
+                damaged = 1;
+            }
+            state = row->hl_open_comment;
+        }
+        if (!damaged) continue;
+        
+        wmove(win, y, 0);
         
         // Line numbers display (if enabled)
-        int lineNumWidth = 0;
-        if (E.showLineNumbers && E.numrows > 0) {
-            lineNumWidth = 6; // Width for line numbers: 4 digits + 1 space + 1 separator
+        if (lineNumWidth) {
             if (filerow < E.numrows) {
-                wattron(E.win, COLOR_PAIR(COLOR_LINE_NUMBER));
-                mvwprintw(E.win, y, 0, "%4d ", filerow + 1);
-                wattroff(E.win, COLOR_PAIR(COLOR_LINE_NUMBER));
-                mvwaddch(E.win, y, 5, '|');
+                wattron(win, COLOR_PAIR(COLOR_LINE_NUMBER));
+                mvwprintw(win, y, 0, "%4d ", filerow + 1);
+                wattroff(win, COLOR_PAIR(COLOR_LINE_NUMBER));
+                mvwaddch(win, y, 5, '|');
             } else {
-                mvwprintw(E.win, y, 0, "     |");
+                mvwprintw(win, y, 0, "     |");
             }
         }
         
@@ -74,51 +165,51 @@ void editorDrawRows() {
                 int padding = (E.screencols - lineNumWidth - welcomelen) / 2;
                 if (padding) {
                     if (!E.showLineNumbers) {
-                        mvwaddch(E.win, y, 0, '~');
+                        mvwaddch(win, y, 0, '~');
                         padding--;
                     }
                 }
                 while (padding-- > 0) 
-                    mvwaddch(E.win, y, lineNumWidth + padding, ' ');
+                    mvwaddch(win, y, lineNumWidth + padding, ' ');
                 
-                mvwprintw(E.win, y, lineNumWidth + (E.screencols - lineNumWidth - welcomelen) / 2, "%s", welcome);
+                mvwprintw(win, y, lineNumWidth + (E.screencols - lineNumWidth - welcomelen) / 2, "%s", welcome);
             } else {
                 if (!E.showLineNumbers)
-                    mvwaddch(E.win, y, 0, '~');
+                    mvwaddch(win, y, 0, '~');
             }
         } else {
-            int len = E.row[filerow].size - E.coloff;
+            int len = row->rsize - E.coloff;
             if (len < 0) len = 0;
             if (len > E.screencols - lineNumWidth) 
                 len = E.screencols - lineNumWidth;
             
             // Apply syntax highlighting based on file type
-            if (E.syntax) {
-                unsigned char *hl = E.row[filerow].hl;
-                int current_color = COLOR_DEFAULT;
-                
-                for (int j = 0; j < len; j++) {
-                    char c = E.row[filerow].render[j + E.coloff];
-                    unsigned char color = hl ? hl[j + E.coloff] : COLOR_DEFAULT;
-                    
-                    if (color != current_color) {
-                        current_color = color;
-                        wattron(E.win, COLOR_PAIR(current_color));
-                    }
-                    
-                    mvwaddch(E.win, y, j + lineNumWidth, c);
-                }
-                wattroff(E.win, COLOR_PAIR(current_color));
-            } else {
-                mvwprintw(E.win, y, lineNumWidth, "%.*s", len, &E.row[filerow].render[E.coloff]);
-            }
+            if (len > 0) editorDrawRowText(y, lineNumWidth, row, len);
         }
-        wclrtoeol(E.win);
+        
+        // A row filling the last column, or one with tabs, runs into the
+        // next line, which then has to be drawn again as well
+        spilled = getcury(win) != y;
+        if (!spilled) wclrtoeol(win);
     }
+    
+    // The status bar is drawn next and will have to cover any spill
+    if (spilled) E.redraw = 1;
+    E.damage_from = INT_MAX;
+    E.damage_to = -1;
 }
 
 void editorDrawStatusBar() {
-    wattron(E.win, A_REVERSE);
+    static char *drawn_bar;
+    static int drawn_cols;
+    static char drawn_msg[80];
+    
+    if (drawn_cols != E.screencols) {
+        drawn_cols = E.screencols;
+        drawn_bar = realloc(drawn_bar, drawn_cols + 1);
+        drawn_bar[0] = '\0';
+        E.redraw = 1;
+    }
     
     char status[80], rstatus[80];
     int len = snprintf(status, sizeof(status), "%.20s %s - %d lines %s",
@@ -128,22 +219,28 @@ void editorDrawStatusBar() {
         E.mode == MODE_INSERT ? "[INSERT]" : E.mode == MODE_COMMAND ? "[COMMAND]" : "[NORMAL]");
     int rlen = snprintf(rstatus, sizeof(rstatus), "%d,%d", E.cy + 1, E.cx + 1);
     
+    // The bar is laid out in full and only drawn if it differs from the
+    // one on screen
+    char bar[E.screencols + 1];
     if (len > E.screencols) len = E.screencols;
-    mvwprintw(E.win, E.screenrows, 0, "%s", status);
+    memset(bar, ' ', E.screencols);
+    memcpy(bar, status, len);
+    if (len + rlen <= E.screencols)
+        memcpy(&bar[E.screencols - rlen], rstatus, rlen);
+    bar[E.screencols] = '\0';
     
-    while (len < E.screencols) {
-        if (E.screencols - len == rlen) {
-            mvwprintw(E.win, E.screenrows, len, "%s", rstatus);
-            break;
-        } else {
-            mvwaddch(E.win, E.screenrows, len, ' ');
-            len++;
-        }
+    if (E.redraw || strcmp(bar, drawn_bar) != 0) {
+        wattron(win, A_REVERSE);
+        mvwaddnstr(win, E.screenrows, 0, bar, E.screencols);
+        wattroff(win, A_REVERSE);
+        memcpy(drawn_bar, bar, E.screencols + 1);
     }
     
-    wattroff(E.win, A_REVERSE);
-    mvwprintw(E.win, E.screenrows + 1, 0, "%s", E.statusmsg);
-    wclrtoeol(E.win);
+    if (E.redraw || strcmp(E.statusmsg, drawn_msg) != 0) {
+        mvwprintw(win, E.screenrows + 1, 0, "%s", E.statusmsg);
+        wclrtoeol(win);
+        strcpy(drawn_msg, E.statusmsg);
+    }
 }
 
 // Scrolling functions
@@ -166,22 +263,28 @@ void editorScroll() {
 }
 
 void editorRefreshScreen() {
+    uint64_t start = editorStatsFrameStart();
+    
     editorScroll();
     
-    wclear(E.win);
+    // Only damaged rows are drawn again, and ncurses sends the terminal
+    // just the cells that differ, so nothing is cleared first
     editorDrawRows();
     editorDrawStatusBar();
+    E.redraw = 0;
     
     // Calculate the correct cursor position accounting for line numbers
     int lineNumWidth = (E.showLineNumbers && E.numrows > 0) ? 6 : 0;
-    wmove(E.win, E.cy - E.rowoff, E.cx - E.coloff + lineNumWidth);
+    wmove(win, E.cy - E.rowoff, E.cx - E.coloff + lineNumWidth);
     
-    wrefresh(E.win);
+    uint64_t drawn = start ? editorStatsNow() : 0;
+    wrefresh(win);
+    editorStatsFrameEnd(start, drawn);
 }
 
 // Editor movement
 void editorMoveCursor(int key) {
-    erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    erow *row = (E.cy >= E.numrows) ? NULL : editorRowAt(E.cy);
     
     switch(key) {
         case 'h':
@@ -190,15 +293,15 @@ void editorMoveCursor(int key) {
             } else if (E.cy > 0) {
                 // Move to end of previous line
                 E.cy--;
-                E.cx = E.row[E.cy].size;
+                E.cx = editorRowAt(E.cy)->size;
             }
             break;
         case 'j':
             if (E.cy < E.numrows - 1) {
                 E.cy++;
                 // Ensure cursor doesn't go beyond the end of the line
-                if (row && E.cx > E.row[E.cy].size) {
-                    E.cx = E.row[E.cy].size;
+                if (row && E.cx > editorRowAt(E.cy)->size) {
+                    E.cx = editorRowAt(E.cy)->size;
                 }
             }
             break;
@@ -206,8 +309,8 @@ void editorMoveCursor(int key) {
             if (E.cy > 0) {
                 E.cy--;
                 // Ensure cursor doesn't go beyond the end of the line
-                if (row && E.cx > E.row[E.cy].size) {
-                    E.cx = E.row[E.cy].size;
+                if (row && E.cx > editorRowAt(E.cy)->size) {
+                    E.cx = editorRowAt(E.cy)->size;
                 }
             }
             break;
@@ -223,7 +326,7 @@ void editorMoveCursor(int key) {
     }
     
     // If we moved to a different line, update row
-    row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    row = (E.cy >= E.numrows) ? NULL : editorRowAt(E.cy);
     
     // Make sure E.cx is within bounds for the new row
     int rowlen = row ? row->size : 0;
@@ -238,20 +341,45 @@ void editorInsertChar(int c) {
         editorAppendRow("", 0);
     }
     
-    editorRowInsertChar(&E.row[E.cy], E.cx, c);
+    editorRowInsertChar(editorRowAt(E.cy), E.cx, c);
     E.cx++;
 }
 
+// Insert text at the cursor as one edit: the row is split once and the
+// lines in between go in as one batch of rows
+void editorInsertText(const char *s, size_t len) {
+    if (E.cy == E.numrows) {
+        editorAppendRow("", 0);
+    }
+    
+    erow *row = editorRowAt(E.cy);
+    size_t taillen = row->size - E.cx;
+    char *tail = malloc(taillen + 1);
+    memcpy(tail, &editorRowChars(row)[E.cx], taillen);
+    
+    const char *nl = memchr(s, '\n', len);
+    size_t first = nl ? (size_t)(nl - s) : len;
+    editorRowTruncate(row, E.cx);
+    editorRowAppendString(row, (char *)s, first);
+    E.cx += first;
+    
+    if (nl) {
+        E.cy += editorInsertRows(E.cy + 1, nl + 1, len - first - 1);
+        row = editorRowAt(E.cy);
+        E.cx = row->size;
+    }
+    if (taillen) editorRowAppendString(row, tail, taillen);
+    free(tail);
+}
+
 void editorInsertNewline() {
     if (E.cx == 0) {
         editorInsertRow(E.cy, "", 0);
     } else {
-        erow *row = &E.row[E.cy];
-        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-        row = &E.row[E.cy];
-        row->size = E.cx;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
+        erow *row = editorRowAt(E.cy);
+        char *chars = editorRowChars(row);
+        editorInsertRow(E.cy + 1, &chars[E.cx], row->size - E.cx);
+        editorRowTruncate(editorRowAt(E.cy), E.cx);
     }
     
     E.cy++;
@@ -262,29 +390,89 @@ void editorDeleteChar() {
     if (E.cy == E.numrows) return;
     if (E.cx == 0 && E.cy == 0) return;
     
-    erow *row = &E.row[E.cy];
+    erow *row = editorRowAt(E.cy);
     if (E.cx > 0) {
         editorRowDelChar(row, E.cx - 1);
         E.cx--;
     } else {
-        E.cx = E.row[E.cy - 1].size;
-        editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
+        E.cx = editorRowAt(E.cy - 1)->size;
+        editorRowAppendString(editorRowAt(E.cy - 1), editorRowChars(row), row->size);
         editorDelRow(E.cy);
         E.cy--;
     }
 }
 
+static char *editorPrompt(char *prompt) {
+    size_t bufsize = 128;
+    char *buf = malloc(bufsize);
+    size_t buflen = 0;
+    buf[0] = '\0';
+    
+    editorSetStatusMessage("%s", prompt);
+    
+    while (1) {
+        editorRefreshScreen();
+        int c = editorReadKey();
+        
+        if (c == KEY_ENTER || c == '\n' || c == '\r') {
+            if (buflen != 0) {
+                editorSetStatusMessage("");
+                return buf;
+            }
+        } else if (c == 27) {  // ESC key
+            editorSetStatusMessage("");
+            free(buf);
+            return NULL;
+        } else if (c == 127 || c == KEY_BACKSPACE) {  // Backspace
+            if (buflen > 0) {
+                buf[--buflen] = '\0';
+            }
+        } else if (!iscntrl(c) && c < 128) {
+            if (buflen == bufsize - 1) {
+                bufsize *= 2;
+                buf = realloc(buf, bufsize);
+            }
+            buf[buflen++] = c;
+            buf[buflen] = '\0';
+        }
+        
+        editorSetStatusMessage("%s%s", prompt, buf);
+    }
+}
+
+// Save, asking for a file name if the buffer has none
+static void editorSaveAs() {
+    if (E.filename == NULL) {
+        E.filename = editorPrompt("Save as: ");
+        if (E.filename == NULL) {
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+        editorSelectSyntaxHighlight();
+    }
+    editorSave();
+}
+
+// Quitting would lose no edits, to this buffer or any other. If it would,
+// say so and how to quit anyway.
+static int editorCanQuit(const char *force) {
+    const char *other = editorBufferModified();
+    
+    if (E.dirty)
+        editorSetStatusMessage("WARNING: File has unsaved changes. %s", force);
+    else if (other)
+        editorSetStatusMessage("WARNING: %s has unsaved changes. %s", other, force);
+    return !E.dirty && !other;
+}
+
 // Command handling
 void editorProcessCommand(char *command) {
     if (strcmp(command, "w") == 0) {
         // Write/save command
-        editorSave();
+        editorSaveAs();
     } else if (strcmp(command, "q") == 0) {
         // Quit command
-        if (E.dirty) {
-            editorSetStatusMessage("WARNING: File has unsaved changes. Use :q! to force quit.");
-            return;
-        }
+        if (!editorCanQuit("Use :q! to force quit.")) return;
         endwin();
         exit(0);
     } else if (strcmp(command, "q!") == 0) {
@@ -293,8 +481,9 @@ void editorProcessCommand(char *command) {
         exit(0);
     } else if (strcmp(command, "wq") == 0) {
         // Write and quit command
-        editorSave();
-        if (!E.dirty) {
+        editorSaveAs();
+        editorSaveWait();
+        if (!E.dirty && editorCanQuit("Use :q! to force quit.")) {
             endwin();
             exit(0);
         }
@@ -306,30 +495,216 @@ void editorProcessCommand(char *command) {
         // Turn on line numbers
         E.showLineNumbers = 1;
         editorSetStatusMessage("Line numbers enabled");
+    } else if (strncmp(command, "set undobudget=", 15) == 0) {
+        // Memory for the undo history, in megabytes
+        E.undo_budget = (size_t)atoi(command + 15) * 1024 * 1024;
+        editorSetStatusMessage("Undo history limited to %d MB", atoi(command + 15));
+    } else if (strncmp(command, "set bufferbudget=", 17) == 0) {
+        // Memory for the buffers not being edited, in megabytes
+        E.buffer_budget = (size_t)atoi(command + 17) * 1024 * 1024;
+        editorSetStatusMessage("Other buffers limited to %d MB", atoi(command + 17));
+    } else if (command[0] == 'e' && (command[1] == ' ' || command[1] == '\0')) {
+        // Edit another file, keeping this one as a buffer
+        const char *filename = command + 1;
+        while (*filename == ' ') filename++;
+        if (*filename)
+            editorBufferEdit(filename);
+        else
+            editorSetStatusMessage("No file name");
+    } else if (strcmp(command, "bn") == 0) {
+        editorBufferNext(1);
+    } else if (strcmp(command, "bp") == 0) {
+        editorBufferNext(-1);
+    } else if (strcmp(command, "ls") == 0) {
+        editorBufferList();
+    } else if (strcmp(command, "stats") == 0) {
+        // Frame times, latency and row memory
+        editorStatsShow();
+    } else if (strcmp(command, "set nostats") == 0) {
+        editorStatsStop();
+        editorSetStatusMessage("Stats no longer collected");
+    } else if (strncmp(command, "set statsfile=", 14) == 0) {
+        // Collect stats and write them out on exit
+        editorStatsDumpOnExit(command + 14);
+        editorSetStatusMessage("Stats written to %s on exit", command + 14);
+    } else if (strcmp(command, "follow") == 0) {
+        // Keep reading the file as it grows
+        editorFollowStart();
+    } else if (strcmp(command, "nofollow") == 0) {
+        editorFollowStop();
+        editorSetStatusMessage("No longer following %s", E.filename ? E.filename : "");
+    } else if (command[0] == 's' && ispunct((unsigned char)command[1])) {
+        // Substitute on this line
+        editorSubstitute(command);
+    } else if (strncmp(command, "%s", 2) == 0 && ispunct((unsigned char)command[2])) {
+        // Substitute on every line
+        editorSubstitute(command);
     } else {
         editorSetStatusMessage("Unknown command: %s", command);
     }
 }
 
+// Wait for a key, letting the background lexer run in the meantime. While
+// a file is being saved the wait is cut into short ones, so the end of the
+// save shows up on the screen as soon as it happens. A followed file that
+// grows is read while waiting, keys that come in going first.
+int editorReadKey() {
+    int c;
+    
+    editorSyntaxResume();
+    while (1) {
+        // Wake up to check on a save, or to write out the journal once
+        // typing stops
+        int wait = editorSaving() ? SAVE_POLL_MS : -1;
+        if (editorJournalPending() && (wait < 0 || wait > JOURNAL_FLUSH_MS)) wait = JOURNAL_FLUSH_MS;
+        
+        if (editorFollowing()) {
+            if ((c = editorPendingKey()) != ERR) break;
+            if (editorFollowWait(wait)) {
+                editorSyntaxPause();
+                editorFollowUpdate();
+                editorRefreshScreen();
+                editorSyntaxResume();
+                continue;
+            }
+            // Whatever woke the wait up is there to be read now
+            if (wait > 0) wait = 0;
+        }
+        wtimeout(win, wait);
+        c = wgetch(win);
+        if (c != ERR || wait < 0) break;
+        
+        editorSyntaxPause();
+        editorJournalFlush();
+        if (editorSavePoll()) editorRefreshScreen();
+        editorSyntaxResume();
+    }
+    wtimeout(win, -1);
+    editorSyntaxPause();
+    return c;
+}
+
+// A key that is already waiting, or ERR if there is none
+int editorPendingKey() {
+    wtimeout(win, 0);
+    int c = wgetch(win);
+    wtimeout(win, -1);
+    return c;
+}
+
+// After an ESC, check whether the terminal is starting a bracketed paste.
+// Keys that turn out to be anything else are put back to be read again.
+static int editorPasteStarts() {
+    const char *seq = PASTE_START + 1;
+    int got[sizeof(PASTE_START)];
+    
+    for (int n = 0; seq[n]; n++) {
+        got[n] = editorPendingKey();
+        if (got[n] != seq[n]) {
+            if (got[n] != ERR) ungetch(got[n]);
+            while (n--) ungetch(got[n]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Read pasted text up to the end of the paste. ncurses reads input a byte
+// per system call, so the text is read from the terminal directly in big
+// blocks; whatever follows the paste is handed back to ncurses. Line breaks
+// come as '\r' or "\r\n" and become '\n', and control characters other
+// than tabs are dropped.
+static char *editorReadPaste(size_t *len) {
+    size_t cap = 64 * 1024, n = 0;
+    size_t endlen = strlen(PASTE_END);
+    char *buf = malloc(cap);
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    int c, prev = 0;
+    
+    while (poll(&pfd, 1, PASTE_TIMEOUT_MS) > 0) {
+        if (cap - n < 4096) {
+            cap *= 2;
+            buf = realloc(buf, cap);
+        }
+        ssize_t got = read(STDIN_FILENO, &buf[n], cap - n);
+        if (got <= 0) break;
+        
+        // The end marker may straddle two reads
+        size_t from = n > endlen ? n - endlen : 0;
+        n += got;
+        char *end = memmem(&buf[from], n - from, PASTE_END, endlen);
+        if (end) {
+            char *rest = end + endlen;
+            for (char *p = &buf[n]; p > rest; ) ungetch((unsigned char)*--p);
+            n = end - buf;
+            break;
+        }
+    }
+    
+    size_t j = 0;
+    for (size_t i = 0; i < n; i++) {
+        c = (unsigned char)buf[i];
+        if (c == '\r' || (c == '\n' && prev != '\r')) {
+            buf[j++] = '\n';
+        } else if (c == '\t' || !iscntrl(c)) {
+            buf[j++] = c;
+        }
+        prev = c;
+    }
+    *len = j;
+    return buf;
+}
+
 // Basic operations
-void editorProcessKeypress() {
+static void editorProcessKey(int c) {
     static char cmdBuffer[128] = {0};
     static int cmdPos = 0;
+    static int quitWarned = 0;
+    int warned = quitWarned;
+    
+    quitWarned = 0;
     
-    int c = wgetch(E.win);
+    // Pasted text goes in as it is rather than being taken as keys; on the
+    // command line only its first line is typed in
+    if (c == 27 && editorPasteStarts()) {
+        size_t len;
+        char *text = editorReadPaste(&len);
+        
+        if (E.mode == MODE_COMMAND) {
+            for (size_t i = 0; i < len && text[i] != '\n'; i++)
+                editorProcessKey((unsigned char)text[i]);
+        } else if (len > 0) {
+            // A paste is undone on its own
+            editorUndoBreak();
+            editorInsertText(text, len);
+            editorUndoBreak();
+        }
+        free(text);
+        return;
+    }
     
     switch (E.mode) {
         case MODE_NORMAL:
+            // Every command in normal mode is undone on its own
+            editorUndoBreak();
             switch (c) {
                 case 'i':
                     E.mode = MODE_INSERT;
                     break;
                 case ':':
+                case '/':
                     E.mode = MODE_COMMAND;
-                    cmdBuffer[0] = ':';
+                    cmdBuffer[0] = c;
                     cmdBuffer[1] = '\0';
                     cmdPos = 1;
                     editorSetStatusMessage("%s", cmdBuffer);
+                    if (c == '/') editorSearchBegin();
+                    break;
+                case 'n':
+                    editorSearchNext(1);
+                    break;
+                case 'N':
+                    editorSearchNext(-1);
                     break;
                 case 'h':
                 case 'j':
@@ -339,14 +714,14 @@ void editorProcessKeypress() {
                     break;
                 case 'x':
                     // Delete character under cursor (like 'x' in vi)
-                    if (E.cy < E.numrows && E.cx < E.row[E.cy].size) {
-                        editorRowDelChar(&E.row[E.cy], E.cx);
+                    if (E.cy < E.numrows && E.cx < editorRowAt(E.cy)->size) {
+                        editorRowDelChar(editorRowAt(E.cy), E.cx);
                     }
                     break;
                 case 'A':
                     // Append at end of line
                     if (E.cy < E.numrows)
-                        E.cx = E.row[E.cy].size;
+                        E.cx = editorRowAt(E.cy)->size;
                     E.mode = MODE_INSERT;
                     break;
                 case 'I':
@@ -357,7 +732,7 @@ void editorProcessKeypress() {
                 case 'o':
                     // Open new line below
                     if (E.cy < E.numrows)
-                        E.cx = E.row[E.cy].size;
+                        E.cx = editorRowAt(E.cy)->size;
                     else
                         E.cx = 0;
                     editorInsertNewline();
@@ -370,29 +745,32 @@ void editorProcessKeypress() {
                     E.mode = MODE_INSERT;
                     break;
                 case CTRL_KEY('q'):
-                    // Clean up and exit
-                    if (E.dirty) {
-                        editorSetStatusMessage("WARNING: File has unsaved changes. Press Ctrl-Q again to quit.");
-                        E.dirty = 2;  // Special value to indicate we've warned once
+                    // Clean up and exit, unless edits would be lost and
+                    // this is not the second Ctrl-Q in a row
+                    if (!warned && !editorCanQuit("Press Ctrl-Q again to quit.")) {
+                        quitWarned = 1;
                         break;
                     }
-                    if (E.dirty == 2) {
-                        endwin();
-                        exit(0);
-                    }
                     endwin();
                     exit(0);
                     break;
                 case CTRL_KEY('s'):
                     // Save file
-                    editorSave();
+                    editorSaveAs();
+                    break;
+                case 'u':
+                    editorUndo();
+                    break;
+                case CTRL_KEY('r'):
+                    editorRedo();
                     break;
             }
             break;
-            
+        
         case MODE_INSERT:
             if (c == 27) {  // ESC key
                 E.mode = MODE_NORMAL;
+                editorUndoBreak();
             } else if (c == KEY_ENTER || c == '\n' || c == '\r') {
                 editorInsertNewline();
             } else if (c == 127 || c == KEY_BACKSPACE) {  // Backspace key
@@ -401,16 +779,20 @@ void editorProcessKeypress() {
                 editorInsertChar(c);
             }
             break;
-            
+        
         case MODE_COMMAND:
             if (c == 27) {  // ESC key
                 E.mode = MODE_NORMAL;
                 editorSetStatusMessage("");
+                if (cmdBuffer[0] == '/') editorSearchEnd(0);
                 cmdBuffer[0] = '\0';
                 cmdPos = 0;
             } else if (c == KEY_ENTER || c == '\n' || c == '\r') {  // Enter key - fixing to detect multiple variants
                 cmdBuffer[cmdPos] = '\0';
-                if (cmdPos > 1) {  // We have a command (more than just ':')
+                editorUndoBreak();
+                if (cmdBuffer[0] == '/') {
+                    editorSearchEnd(1);
+                } else if (cmdPos > 1) {  // We have a command (more than just ':')
                     editorProcessCommand(cmdBuffer + 1);  // Skip the ':' character
                 }
                 E.mode = MODE_NORMAL;
@@ -421,7 +803,9 @@ void editorProcessKeypress() {
                     cmdPos--;
                     cmdBuffer[cmdPos] = '\0';
                     editorSetStatusMessage("%s", cmdBuffer);
+                    if (cmdBuffer[0] == '/') editorSearchUpdate(cmdBuffer + 1);
                 } else if (cmdPos == 1) {
+                    if (cmdBuffer[0] == '/') editorSearchEnd(0);
                     E.mode = MODE_NORMAL;
                     cmdBuffer[0] = '\0';
                     cmdPos = 0;
@@ -431,15 +815,28 @@ void editorProcessKeypress() {
                 cmdBuffer[cmdPos++] = c;
                 cmdBuffer[cmdPos] = '\0';
                 editorSetStatusMessage("%s", cmdBuffer);
+                
+                // Search as the pattern is typed
+                if (cmdBuffer[0] == '/') editorSearchUpdate(cmdBuffer + 1);
             }
             break;
     }
 }
 
-void editorSetStatusMessage(const char *fmt, ...) {
-    va_list ap;
-    va_start(ap, fmt);
-    vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
-    va_end(ap);
-    E.statusmsg_time = time(NULL);
-}
\ No newline at end of file
+// Wait for a key and apply it along with every key typed or pasted in the
+// meantime, so the screen is painted once per batch rather than per key.
+// A batch ends after INPUT_LATENCY_MAX_MS to keep the screen following.
+void editorProcessKeypress() {
+    struct timespec start, now;
+    int c = editorReadKey();
+    
+    editorStatsKey();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (1) {
+        editorProcessKey(c);
+        
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (ms >= INPUT_LATENCY_MAX_MS || (c = editorPendingKey()) == ERR) break;
+    }
+}
@@ -1,99 +1,434 @@
 #include "axcode.h"
 
-void editorOpen(char *filename) {
-    FILE *fp;
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
+// Drop the rows of the current file along with the memory they point into.
+// The terminal frontend stops searching and following the file first.
+void editorCloseFile() {
+    // A save may still be writing text of the file
+    editorSaveWait();
+    editorJournalClose();
+    editorUndoClear();
+    editorRowTreeClear();
+    E.hl_marks_row = NULL;
+    if (E.mapped) munmap(E.text, E.textsize);
+    editorLineIndexFree(&E.lines);
+    arenaFree(&E.arena);
+    E.text = NULL;
+    E.textsize = 0;
+    E.mapped = 0;
+}
+
+// Point a row at line `line` of the loaded text without copying it
+void editorMapRow(erow *row, int line) {
+    size_t len;
+    size_t start = editorLineSpan(&E.lines, E.text, line, &len);
+    
+    row->size = len;
+    row->chars = &E.text[start];
+    row->gap = row->size;
+    row->cap = 0;
+    row->rsize = 0;
+    row->rgap = 0;
+    row->rcap = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->hl_in = -1;
+    row->hl_open_comment = 0;
+    row->leaf = NULL;
+}
 
+// Read the whole file into one slab of E.arena. Regular files are read
+// straight into place; pipes and the like go through a growing buffer, as
+// do regular files that turn out bigger than they said, such as those of
+// /proc, or that grow while they are read.
+static char *editorReadAll(int fd, struct stat *st, size_t *len) {
+    int heap = !S_ISREG(st->st_mode);
+    size_t cap = heap ? 64 * 1024 : (size_t)st->st_size + 1;
+    char *buf = heap ? malloc(cap) : arenaAlloc(&E.arena, cap);
+    ssize_t n;
+    
+    *len = 0;
+    while (buf && (n = read(fd, &buf[*len], cap - *len)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (heap) free(buf);
+            return NULL;
+        }
+        *len += n;
+        if (*len == cap) {
+            char *bigger = heap ? realloc(buf, cap * 2) : malloc(cap * 2);
+            if (bigger && !heap) memcpy(bigger, buf, *len);
+            if (!bigger && heap) free(buf);
+            buf = bigger;
+            heap = 1;
+            cap *= 2;
+        }
+    }
+    
+    if (buf && heap) {
+        char *text = arenaAlloc(&E.arena, *len + 1);
+        if (text) memcpy(text, buf, *len);
+        free(buf);
+        buf = text;
+    }
+    return buf;
+}
+
+// Index the lines of the text and build the row tree over it. Rows are
+// only created when a part of the file is viewed or edited (see rowtree.c)
+// and point into text until they are changed. Rows hold at most INT_MAX
+// lines of at most INT_MAX bytes.
+static int editorLoadText(char *text, size_t size, int mapped) {
+    int fits = 1;
+    
+    editorScanLines(&E.lines, text, size, 1);
+    if (E.lines.nlines > INT_MAX) fits = 0;
+    for (size_t i = 0; fits && size > INT_MAX && i < E.lines.nlines; i++)
+        if (editorLineStart(&E.lines, i + 1) - editorLineStart(&E.lines, i) > INT_MAX) fits = 0;
+    if (!fits) {
+        editorLineIndexFree(&E.lines);
+        return -1;
+    }
+    
+    E.text = text;
+    E.textsize = size;
+    E.mapped = mapped;
+    editorRowTreeLoadLines(E.lines.nlines);
+    return 0;
+}
+
+// Open filename in place of the current file. Returns 0 if it was read,
+// -1 with a message saying why if it was not.
+int editorOpen(char *filename) {
+    struct stat st;
+    char *text = NULL;
+    size_t len = 0;
+    int mapped = 0;
+    
     free(E.filename);
     E.filename = strdup(filename);
     
-    fp = fopen(filename, "r");
-    if (!fp) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        int err = errno;
+        if (fd != -1) close(fd);
         editorSetStatusMessage("Cannot open file");
-        return;
+        
+        // A new file is journalled from its first edit like any other
+        if (err == ENOENT && E.numrows == 0) editorJournalOpen(filename);
+        return -1;
     }
     
     // Clear existing content
-    for (int i = 0; i < E.numrows; i++) {
-        editorFreeRow(&E.row[i]);
+    editorCloseFile();
+    
+    // Big files are mapped rather than read, so opening them costs no more
+    // than indexing their lines
+    if (S_ISREG(st.st_mode) && st.st_size >= MMAP_THRESHOLD) {
+        text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED) {
+            text = NULL;
+        } else {
+            len = st.st_size;
+            mapped = 1;
+        }
     }
-    free(E.row);
-    E.numrows = 0;
-    E.row = NULL;
+    if (!text) text = editorReadAll(fd, &st, &len);
+    close(fd);
     
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
-        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
-            linelen--;
-        editorAppendRow(line, linelen);
+    if (!text || editorLoadText(text, len, mapped) < 0) {
+        if (mapped) munmap(text, len);
+        arenaFree(&E.arena);
+        editorSetStatusMessage(text ? "Cannot read file: a line of 2 GB or more, or too many lines" : "Cannot read file");
+        return -1;
     }
-    free(line);
-    fclose(fp);
     E.dirty = 0;
     editorSelectSyntaxHighlight();
+    editorDamageScreen();
+    editorJournalOpen(filename);
+    return 0;
 }
 
-void editorSave() {
-    if (E.filename == NULL) {
-        E.filename = editorPrompt("Save as: ");
-        if (E.filename == NULL) {
-            editorSetStatusMessage("Save aborted");
-            return;
-        }
-        editorSelectSyntaxHighlight();
-    }
+// Rows are written with writev in batches of this many pieces
+#define SAVE_IOV 1024
+// Edited rows are copied into blocks of this size for a save
+#define SAVE_BLOCK (64 * 1024)
+
+// A save in progress. The text to write is captured when the save starts
+// as a list of pieces: rows still pointing into the loaded file are taken
+// as they are, since that text never changes while it is loaded, and only
+// edited rows are copied. The file is then written on a thread of its own
+// while editing goes on.
+struct saveJob {
+    char *filename;
+    struct iovec *iov;  // Pieces of the text, in order
+    int n, cap;
+    arena copies;       // Copies of the edited rows
+    char *block;        // Block edited rows are copied into
+    size_t room;        // Bytes left in block
+    unsigned long changes; // E.changes when the text was captured
+    uint64_t journal;   // Where the journal stood then
+    int inplace;        // The file may be written over; not if rows point into it
+    int error;          // errno of the step that failed, 0 if saved
+    const char *warning; // What the save could not keep, NULL if nothing
+    int done;           // Set by the thread when it is finished
+    pthread_t thread;
+};
+
+// Append a piece of text, merging it into the last one if it follows on
+static void saveAdd(struct saveJob *job, char *text, size_t len) {
+    if (len == 0) return;
     
-    FILE *fp = fopen(E.filename, "w");
-    if (!fp) {
-        editorSetStatusMessage("Cannot save file");
+    struct iovec *last = job->n ? &job->iov[job->n - 1] : NULL;
+    if (last && (char *)last->iov_base + last->iov_len == text) {
+        last->iov_len += len;
         return;
     }
     
-    for (int i = 0; i < E.numrows; i++) {
-        fwrite(E.row[i].chars, 1, E.row[i].size, fp);
-        fwrite("\n", 1, 1, fp);
+    if (job->n == job->cap) {
+        job->cap = job->cap ? job->cap * 2 : 256;
+        job->iov = realloc(job->iov, sizeof(struct iovec) * job->cap);
     }
-    
-    fclose(fp);
-    E.dirty = 0;
-    editorSetStatusMessage("File saved");
+    job->iov[job->n].iov_base = text;
+    job->iov[job->n++].iov_len = len;
 }
 
-char *editorPrompt(char *prompt) {
-    size_t bufsize = 128;
-    char *buf = malloc(bufsize);
-    size_t buflen = 0;
-    buf[0] = '\0';
+// Copy text that may change before it is written
+static void saveCopy(struct saveJob *job, const char *text, size_t len) {
+    if (len == 0) return;
+    if (job->room < len) {
+        job->room = len > SAVE_BLOCK ? len : SAVE_BLOCK;
+        job->block = arenaAlloc(&job->copies, job->room);
+    }
+    memcpy(job->block, text, len);
+    saveAdd(job, job->block, len);
+    job->block += len;
+    job->room -= len;
+}
 
-    editorSetStatusMessage("%s", prompt);
+// Capture every row followed by a newline. Rows still pointing into the
+// loaded file take their newline along from it, and rows that follow each
+// other there become one piece, so the unchanged parts of a big file are
+// written in a few large blocks.
+static void saveSnapshot(struct saveJob *job) {
+    static char newline[] = "\n";
+    rowIter it;
+    erow *row;
     
-    while (1) {
-        editorRefreshScreen();
-        int c = wgetch(E.win);
+    editorRowIterInit(&it, 0, 0);
+    while ((row = editorRowIterNext(&it)) != NULL) {
+        char *end = &row->chars[row->gap];
+        int tail = row->size - row->gap;
         
-        if (c == KEY_ENTER || c == '\n' || c == '\r') {
-            if (buflen != 0) {
-                editorSetStatusMessage("");
-                return buf;
-            }
-        } else if (c == 27) {  // ESC key
-            editorSetStatusMessage("");
-            free(buf);
-            return NULL;
-        } else if (c == 127 || c == KEY_BACKSPACE) {  // Backspace
-            if (buflen > 0) {
-                buf[--buflen] = '\0';
-            }
-        } else if (!iscntrl(c) && c < 128) {
-            if (buflen == bufsize - 1) {
-                bufsize *= 2;
-                buf = realloc(buf, bufsize);
-            }
-            buf[buflen++] = c;
-            buf[buflen] = '\0';
+        if (row->cap) {
+            saveCopy(job, row->chars, row->gap);
+            saveCopy(job, &row->chars[row->cap - tail], tail);
+            saveCopy(job, newline, 1);
+        } else if (end < E.text + E.textsize && *end == '\n') {
+            saveAdd(job, row->chars, row->size + 1);
+        } else {
+            saveAdd(job, row->chars, row->size);
+            saveAdd(job, newline, 1);
         }
+    }
+}
+
+// Write all of iov, carrying on after partial writes
+static int saveWritev(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n < SAVE_IOV ? n : SAVE_IOV);
+        if (w < 0) return -1;
         
-        editorSetStatusMessage("%s%s", prompt, buf);
+        while (n > 0 && (size_t)w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
+
+// Flush the directory entry of path to disk, so a rename into it survives
+// a crash too
+void editorSyncDir(const char *path) {
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash - path + 1) : strdup(".");
+    int fd = open(dir, O_RDONLY);
+    
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+// Write the text over the file itself. Unlike a rename this keeps its
+// other names and its owner, but a crash part way leaves it half written.
+static int saveOverwrite(struct saveJob *job, const char *path) {
+    int fd = open(path, O_WRONLY | O_TRUNC);
+    if (fd == -1) return errno;
+    
+    int err = 0;
+    if (saveWritev(fd, job->iov, job->n) < 0 || fsync(fd) < 0) err = errno;
+    if (close(fd) != 0 && !err) err = errno;
+    return err;
+}
+
+// Create a file next to path to write the text into. A new file gets the
+// mode open() gives it, which the umask is applied to without being read:
+// umask() changes it for every thread while it is asked. Returns the file
+// or -1, its name in tmp.
+static int saveCreateTemp(const char *path, int replacing, char *tmp, size_t size) {
+    static unsigned long count;
+    
+    for (int tries = 0; tries < 100; tries++) {
+        unsigned long n = __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+        snprintf(tmp, size, "%s.ax%lx.%lx", path, (unsigned long)getpid(), n);
+        int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, replacing ? 0600 : 0666);
+        if (fd != -1 || errno != EEXIST) return fd;
+    }
+    return -1;
+}
+
+// Write the text next to the file at path and rename it into place, so the
+// file is never left half written and rows of a mapped file, which still
+// point into the old contents, stay valid. st is the file being replaced,
+// NULL if there is none. Returns 0 or an errno value.
+static int saveReplace(struct saveJob *job, const char *path, struct stat *st) {
+    size_t tmplen = strlen(path) + 48;
+    char *tmp = malloc(tmplen);
+    
+    int fd = saveCreateTemp(path, st != NULL, tmp, tmplen);
+    if (fd == -1) {
+        free(tmp);
+        return errno;
+    }
+    
+    // Keep the mode and owner of the file being replaced. A file whose
+    // owner cannot be given to a new one is written over instead if it can
+    // be.
+    if (st && fchown(fd, st->st_uid, st->st_gid) != 0) {
+        if (job->inplace) {
+            close(fd);
+            unlink(tmp);
+            free(tmp);
+            return saveOverwrite(job, path);
+        }
+        job->warning = "its owner could not be kept";
     }
-}
\ No newline at end of file
+    if (st && fchmod(fd, st->st_mode & 07777) != 0)
+        job->warning = "its mode could not be kept";
+    
+    int err = 0;
+    if (saveWritev(fd, job->iov, job->n) < 0 || fsync(fd) < 0) err = errno;
+    if (close(fd) != 0 && !err) err = errno;
+    if (!err && rename(tmp, path) != 0) err = errno;
+    
+    if (err) {
+        unlink(tmp);
+    } else {
+        editorSyncDir(path);
+    }
+    free(tmp);
+    return err;
+}
+
+// Save to the file a symbolic link points at rather than over the link.
+// A file with other hard links is written over, so they see the new text
+// too, unless rows still point into it. Returns 0 or an errno value.
+static int saveWrite(struct saveJob *job) {
+    char *path = realpath(job->filename, NULL);
+    if (!path) path = strdup(job->filename);
+    
+    struct stat st;
+    int exists = stat(path, &st) == 0;
+    int err;
+    if (exists && st.st_nlink > 1 && job->inplace) {
+        err = saveOverwrite(job, path);
+    } else {
+        if (exists && st.st_nlink > 1) job->warning = "its other hard links still hold the old text";
+        err = saveReplace(job, path, exists ? &st : NULL);
+    }
+    free(path);
+    return err;
+}
+
+static void *saveThread(void *arg) {
+    struct saveJob *job = arg;
+    
+    job->error = saveWrite(job);
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Report on the finished save. The buffer is only clean if it was not
+// edited after its text was captured.
+static void saveFinish() {
+    struct saveJob *job = E.saving;
+    
+    E.save_error = job->error;
+    if (job->error) {
+        editorSetStatusMessage("Cannot save file: %s", strerror(job->error));
+    } else {
+        if (job->changes == E.changes) E.dirty = 0;
+        if (job->warning)
+            editorSetStatusMessage("File saved, but %s", job->warning);
+        else
+            editorSetStatusMessage("File saved");
+        // Says so if the journal could not be carried over
+        editorJournalSaved(job->journal, job->filename);
+    }
+    
+    free(job->filename);
+    free(job->iov);
+    arenaFree(&job->copies);
+    free(job);
+    E.saving = NULL;
+}
+
+int editorSaving() {
+    return E.saving != NULL;
+}
+
+// Report on the save if it has finished; returns 1 if it has
+int editorSavePoll() {
+    if (!E.saving || !__atomic_load_n(&E.saving->done, __ATOMIC_ACQUIRE)) return 0;
+    pthread_join(E.saving->thread, NULL);
+    saveFinish();
+    return 1;
+}
+
+// Wait for the save in progress, if any, to finish
+void editorSaveWait() {
+    if (!E.saving) return;
+    pthread_join(E.saving->thread, NULL);
+    saveFinish();
+}
+
+void editorSave() {
+    if (E.filename == NULL) {
+        editorSetStatusMessage("No file name");
+        return;
+    }
+    
+    // One save at a time, so the last one started is the one that sticks
+    editorSaveWait();
+    
+    struct saveJob *job = calloc(1, sizeof(*job));
+    job->filename = strdup(E.filename);
+    job->changes = E.changes;
+    job->journal = editorJournalMark();
+    job->inplace = !E.mapped;
+    saveSnapshot(job);
+    E.saving = job;
+    
+    if (pthread_create(&job->thread, NULL, saveThread, job) != 0) {
+        saveThread(job);
+        saveFinish();
+        return;
+    }
+    editorSetStatusMessage("Saving...");
+}
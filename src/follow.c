@@ -0,0 +1,142 @@
+#include "axcode.h"
+#include <sys/inotify.h>
+
+// :follow keeps reading a file that is still being written, such as a log.
+// inotify says when the file changed; only the bytes past what was read so
+// far are read then, at most FOLLOW_BATCH at a time, and added as rows at
+// the end, so keeping up costs the same however big the file has grown.
+// A line the writer has not finished yet is shown as it is and carried on
+// when the rest of it comes in.
+static int followFd = -1;       // inotify instance, -1 if not following
+static int followFile = -1;     // The file, read from followOffset on
+static off_t followOffset;
+static int followJoin;          // The last row is an unfinished line
+static int followMore;          // The last read stopped at FOLLOW_BATCH
+static char *followBuf;
+static struct editorConfig *followOwner; // Buffer the file is read into
+
+int editorFollowing() {
+    return followFd != -1 && followOwner == editorCurrent;
+}
+
+void editorFollowStop() {
+    if (!editorFollowing()) return;
+    
+    close(followFd);
+    close(followFile);
+    followFd = -1;
+    followFile = -1;
+    free(followBuf);
+    followBuf = NULL;
+}
+
+static void followFail(const char *why) {
+    editorSetStatusMessage("%s %s, no longer following", E.filename, why);
+    editorFollowStop();
+}
+
+// Start following the current file from the end of the text it was opened
+// with, so whatever was written since is read first
+void editorFollowStart() {
+    struct stat st;
+    
+    if (followFd != -1) {
+        editorSetStatusMessage("Already following %s", E.filename);
+        return;
+    }
+    if (!E.filename) {
+        editorSetStatusMessage("No file name");
+        return;
+    }
+    
+    followFile = open(E.filename, O_RDONLY | O_CLOEXEC);
+    if (followFile == -1 || fstat(followFile, &st) == -1 || !S_ISREG(st.st_mode)) {
+        editorSetStatusMessage("Cannot follow %s", E.filename);
+        if (followFile != -1) close(followFile);
+        followFile = -1;
+        return;
+    }
+    followFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (followFd == -1 || inotify_add_watch(followFd, E.filename, IN_MODIFY | IN_DELETE_SELF | IN_MOVE_SELF) == -1) {
+        editorSetStatusMessage("Cannot watch %s: %s", E.filename, strerror(errno));
+        if (followFd != -1) close(followFd);
+        close(followFile);
+        followFd = -1;
+        followFile = -1;
+        return;
+    }
+    
+    followOffset = E.textsize;
+    followJoin = E.textsize > 0 && E.text[E.textsize - 1] != '\n';
+    followMore = 1;
+    followBuf = malloc(FOLLOW_BATCH);
+    followOwner = editorCurrent;
+    editorSetStatusMessage("Following %s", E.filename);
+}
+
+// Wait up to ms milliseconds, or for good if ms is negative, for a key or
+// for the file to change. Returns 1 if there is more of the file to read.
+int editorFollowWait(int ms) {
+    struct pollfd pfd[2] = { { STDIN_FILENO, POLLIN, 0 }, { followFd, POLLIN, 0 } };
+    
+    if (followMore) return 1;
+    if (poll(pfd, 2, ms) <= 0 || (pfd[0].revents & POLLIN)) return 0;
+    return (pfd[1].revents & POLLIN) != 0;
+}
+
+// Read the next batch of the file past followOffset and add it as rows.
+// The cursor follows the end of the file if it was on the last row, unless
+// text is being typed there.
+void editorFollowUpdate() {
+    struct inotify_event *ev;
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    struct stat st;
+    
+    // Only whether the file is still there matters, not what happened
+    while ((n = read(followFd, events, sizeof(events))) > 0) {
+        for (char *p = events; p < events + n; p += sizeof(*ev) + ev->len) {
+            ev = (struct inotify_event *)p;
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                followFail("was moved or deleted");
+                return;
+            }
+        }
+    }
+    if (fstat(followFile, &st) == 0 && st.st_size < followOffset) {
+        followFail("was truncated");
+        return;
+    }
+    
+    n = pread(followFile, followBuf, FOLLOW_BATCH, followOffset);
+    if (n < 0) {
+        followFail("cannot be read");
+        return;
+    }
+    followMore = n == FOLLOW_BATCH;
+    
+    // '\r's at the end may come before a '\n' not read yet, unless they
+    // fill the whole batch
+    ssize_t len = n;
+    while (len > 0 && followBuf[len - 1] == '\r') len--;
+    if (len > 0 || !followMore) n = len;
+    if (n == 0) return;
+    followOffset += n;
+    
+    // Lines lose the '\r's before their '\n' as the rows of the loaded
+    // text do
+    char *out = followBuf;
+    for (char *p = followBuf; p < followBuf + n; p++) {
+        if (*p == '\n')
+            while (out > followBuf && out[-1] == '\r') out--;
+        *out++ = *p;
+    }
+    
+    int atEnd = E.mode != MODE_INSERT && E.cy >= E.numrows - 1;
+    editorAppendFileRows(followBuf, out - followBuf, followJoin);
+    followJoin = out[-1] != '\n';
+    if (atEnd && E.numrows > 0) {
+        E.cy = E.numrows - 1;
+        E.cx = 0;
+    }
+}
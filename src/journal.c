@@ -0,0 +1,455 @@
+#include "axcode.h"
+
+// Edits that have not been saved are appended to a journal next to the file,
+// so they can be recovered if the editor or its terminal dies. Every edit
+// made at the row primitives becomes a record: an op byte (bit 0 set for a
+// deletion, bit 1 for whole rows), then the row, the column for edits
+// within a row and the length as varints, then the text of an insertion.
+// Records are buffered and written out in batches as enough pile up, and
+// made sure of on the disk once the oldest has waited long enough or typing
+// stops. While typing goes on they are synced by a thread of their own, so
+// neither typing nor an edit of many rows waits for the disk.
+// Saving the file empties the journal; quitting removes it.
+#define JOURNAL_MAGIC "AXJ1"
+#define JOURNAL_DELETE 1
+#define JOURNAL_ROWS 2
+
+// The file the journalled edits apply to, as it was on disk
+struct journalHeader {
+    char magic[4];
+    uint32_t unused;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+// The journal of a buffer, made along with it when its file is opened
+struct journalState {
+    char *path;         // NULL if the buffer has no file name
+    struct journalHeader base;
+    int fd;             // -1 until the first edit
+    char *buf;          // Records not written yet
+    size_t len, cap;
+    uint64_t bytes;     // Bytes of records so far, written or not
+    struct timespec since; // When the oldest unwritten record was made
+    int unsynced;       // Records were written but may not be on the disk yet
+    int syncing;        // syncer is syncing the records written before it started
+    pthread_t syncer;
+    int sync_fd;        // Its own descriptor of the journal
+    int sync_error;     // errno if its sync failed
+    int sync_done;      // Set by it when it is finished
+    int replaying;
+};
+
+static struct journalState *journalGet() {
+    if (!E.journal) {
+        E.journal = calloc(1, sizeof(struct journalState));
+        E.journal->fd = -1;
+    }
+    return E.journal;
+}
+
+// .name.axj in the directory of filename
+static char *journalPathFor(const char *filename) {
+    const char *slash = strrchr(filename, '/');
+    int dirlen = slash ? slash - filename + 1 : 0;
+    size_t len = strlen(filename) + 6;
+    char *path = malloc(len);
+    
+    snprintf(path, len, "%.*s.%s.axj", dirlen, filename, filename + dirlen);
+    return path;
+}
+
+static void journalSetBase(const char *filename) {
+    struct journalState *j = journalGet();
+    struct stat st;
+    
+    memset(&j->base, 0, sizeof(j->base));
+    memcpy(j->base.magic, JOURNAL_MAGIC, 4);
+    if (stat(filename, &st) == 0) {
+        j->base.size = st.st_size;
+        j->base.mtime_sec = st.st_mtim.tv_sec;
+        j->base.mtime_nsec = st.st_mtim.tv_nsec;
+    }
+    
+    free(j->path);
+    j->path = journalPathFor(filename);
+}
+
+static int journalWriteAll(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += w;
+        len -= w;
+    }
+    return 0;
+}
+
+static void journalFail();
+
+static void *journalSyncThread(void *arg) {
+    struct journalState *j = arg;
+    
+    j->sync_error = fdatasync(j->sync_fd) < 0 ? errno : 0;
+    close(j->sync_fd);
+    __atomic_store_n(&j->sync_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Collect the sync running in the background, if it finished or wait is
+// set, giving up the journal if it failed
+static void journalSyncReap(int wait) {
+    struct journalState *j = journalGet();
+    
+    if (!j->syncing || (!wait && !__atomic_load_n(&j->sync_done, __ATOMIC_ACQUIRE))) return;
+    pthread_join(j->syncer, NULL);
+    j->syncing = 0;
+    if (j->sync_error) {
+        errno = j->sync_error;
+        journalFail();
+    }
+}
+
+// Sync the records written so far without waiting for the disk, unless a
+// sync is still running, in which case the next one takes them
+static void journalSyncStart() {
+    struct journalState *j = journalGet();
+    
+    journalSyncReap(0);
+    if (j->syncing || !j->unsynced || (j->sync_fd = dup(j->fd)) == -1) return;
+    
+    j->sync_done = 0;
+    j->unsynced = 0;
+    j->syncing = 1;
+    if (pthread_create(&j->syncer, NULL, journalSyncThread, j) != 0) {
+        j->syncing = 0;
+        journalSyncThread(j);
+        if (j->sync_error) {
+            errno = j->sync_error;
+            journalFail();
+        }
+    }
+}
+
+// Stop journalling after the journal could not be written
+static void journalFail() {
+    struct journalState *j = journalGet();
+    int err = errno;
+    
+    journalSyncReap(1);
+    editorSetStatusMessage("Recovery journal disabled: %s", strerror(err));
+    if (j->fd != -1) close(j->fd);
+    j->fd = -1;
+    j->len = 0;
+    j->unsynced = 0;
+    free(j->path);
+    j->path = NULL;
+}
+
+// Create the journal on the first edit
+static int journalStart() {
+    struct journalState *j = journalGet();
+    
+    if (j->fd != -1) return 0;
+    if (!E.journalling || !j->path) return -1;
+    
+    j->fd = open(j->path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (j->fd == -1 || journalWriteAll(j->fd, (char *)&j->base, sizeof(j->base)) < 0) {
+        journalFail();
+        return -1;
+    }
+    j->bytes = 0;
+    return 0;
+}
+
+static void journalPut(const void *data, size_t len) {
+    struct journalState *j = journalGet();
+    
+    if (j->cap < j->len + len) {
+        j->cap = j->cap ? j->cap : 4096;
+        while (j->cap < j->len + len) j->cap *= 2;
+        j->buf = realloc(j->buf, j->cap);
+    }
+    memcpy(&j->buf[j->len], data, len);
+    j->len += len;
+    j->bytes += len;
+}
+
+static void journalPutVarint(uint64_t v) {
+    unsigned char b[10];
+    int n = 0;
+    
+    while (v >= 0x80) {
+        b[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    b[n++] = v;
+    journalPut(b, n);
+}
+
+static long journalAgeMs() {
+    struct journalState *j = journalGet();
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - j->since.tv_sec) * 1000 + (now.tv_nsec - j->since.tv_nsec) / 1000000;
+}
+
+// Write out the records made so far
+static int journalWrite() {
+    struct journalState *j = journalGet();
+    
+    if (j->len == 0) return 0;
+    
+    if (journalWriteAll(j->fd, j->buf, j->len) < 0) {
+        journalFail();
+        return -1;
+    }
+    j->len = 0;
+    j->unsynced = 1;
+    
+    // Don't hold on to the memory of a big paste
+    if (j->cap > 4 * JOURNAL_FLUSH_BYTES) {
+        free(j->buf);
+        j->buf = NULL;
+        j->cap = 0;
+    }
+    return 0;
+}
+
+// Write out the records made so far and make sure they reached the disk
+void editorJournalFlush() {
+    struct journalState *j = journalGet();
+    
+    journalSyncReap(1);
+    if (j->fd == -1 || journalWrite() < 0 || !j->unsynced) return;
+    
+    if (fdatasync(j->fd) < 0) {
+        journalFail();
+        return;
+    }
+    j->unsynced = 0;
+}
+
+int editorJournalPending() {
+    struct journalState *j = journalGet();
+    return j->len > 0 || j->unsynced || j->syncing;
+}
+
+// Called by the row primitives for every edit. For deletions only the
+// length is kept: the number of bytes, or of rows for whole rows.
+void editorJournalRecord(int type, int rows, int row, int col, const char *text, size_t len) {
+    struct journalState *j = journalGet();
+    
+    if (j->replaying || journalStart() < 0) return;
+    
+    if (j->len == 0) clock_gettime(CLOCK_MONOTONIC, &j->since);
+    
+    unsigned char op = (type == UNDO_DELETE ? JOURNAL_DELETE : 0) | (rows ? JOURNAL_ROWS : 0);
+    journalPut(&op, 1);
+    journalPutVarint(row);
+    if (!rows) journalPutVarint(col);
+    journalPutVarint(len);
+    if (type == UNDO_INSERT) journalPut(text, len);
+    
+    // Only written here; the disk is waited for by the sync thread, or
+    // when typing stops
+    if (journalAgeMs() >= JOURNAL_FLUSH_MS) {
+        if (journalWrite() == 0) journalSyncStart();
+    } else if (j->len >= JOURNAL_FLUSH_BYTES) {
+        journalWrite();
+    }
+}
+
+static int journalGetVarint(const unsigned char **p, const unsigned char *end, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char b = *(*p)++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return 0;
+    }
+    return -1;
+}
+
+// Apply the records in buf to the buffer; stops at a record cut short by a
+// crash or one that does not fit the buffer. Returns the edits applied.
+static int journalReplay(const unsigned char *p, const unsigned char *end) {
+    int n = 0;
+    
+    while (p < end) {
+        unsigned char op = *p++;
+        uint64_t row, col = 0, len;
+        
+        if (journalGetVarint(&p, end, &row) < 0) break;
+        if (!(op & JOURNAL_ROWS) && journalGetVarint(&p, end, &col) < 0) break;
+        if (journalGetVarint(&p, end, &len) < 0) break;
+        if (!(op & JOURNAL_DELETE) && len > (uint64_t)(end - p)) break;
+        
+        if (op & JOURNAL_ROWS) {
+            if (op & JOURNAL_DELETE) {
+                if (row + len > (uint64_t)E.numrows) break;
+                editorDelRows(row, len);
+            } else {
+                if (row > (uint64_t)E.numrows) break;
+                editorInsertRows(row, (const char *)p, len);
+            }
+        } else {
+            if (row >= (uint64_t)E.numrows) break;
+            erow *r = editorRowAt(row);
+            if (col > (uint64_t)r->size) break;
+            if (op & JOURNAL_DELETE) {
+                editorRowDelString(r, col, len);
+            } else {
+                editorRowInsertString(r, col, (const char *)p, len);
+            }
+        }
+        if (!(op & JOURNAL_DELETE)) p += len;
+        n++;
+    }
+    return n;
+}
+
+// Read the journal of the file just opened, if there is one for this very
+// version of the file, and offer to replay it
+void editorJournalOpen(const char *filename) {
+    struct journalState *j = journalGet();
+    
+    if (!E.journalling) return;
+    journalSetBase(filename);
+    
+    int fd = open(j->path, O_RDONLY);
+    struct stat st;
+    if (fd == -1) return;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size <= sizeof(struct journalHeader)) {
+        close(fd);
+        return;
+    }
+    
+    size_t size = st.st_size;
+    unsigned char *buf = malloc(size);
+    ssize_t got = read(fd, buf, size);
+    close(fd);
+    
+    struct journalHeader *h = (struct journalHeader *)buf;
+    if (got != (ssize_t)size || memcmp(h, &j->base, sizeof(*h)) != 0) {
+        editorSetStatusMessage("Ignoring recovery journal %s: the file has changed", j->path);
+        free(buf);
+        return;
+    }
+    
+    // Without a frontend to ask, the edits are recovered rather than lost
+    char question[PATH_MAX + 64];
+    snprintf(question, sizeof(question), "Unsaved changes found in %s. Recover them? (y/n)", j->path);
+    if (E.ask && !E.ask(question)) {
+        unlink(j->path);
+        editorSetStatusMessage("Recovery journal discarded");
+        free(buf);
+        return;
+    }
+    
+    // Keep journalling after the recovered edits, which still apply to the
+    // file on disk
+    editorUndoBreak();
+    j->replaying = 1;
+    int n = journalReplay(buf + sizeof(*h), buf + size);
+    j->replaying = 0;
+    editorUndoBreak();
+    
+    j->fd = open(j->path, O_RDWR | O_APPEND);
+    j->bytes = size - sizeof(*h);
+    editorSetStatusMessage("Recovered %d edits", n);
+    free(buf);
+}
+
+// Where the journal stands; edits after this point are not in a save
+// started now
+uint64_t editorJournalMark() {
+    struct journalState *j = journalGet();
+    return j->bytes;
+}
+
+// The buffer was saved to filename as it was at mark. The journal now
+// starts from the saved file and only keeps the edits made since, which
+// are written to a new journal renamed over the old one, so a crash leaves
+// one or the other. If they cannot be carried over, the old journal is
+// left as it is and journalling stops.
+void editorJournalSaved(uint64_t mark, const char *filename) {
+    struct journalState *j = journalGet();
+    
+    editorJournalFlush();
+    if (j->fd == -1 || j->bytes <= mark) {
+        editorJournalClose();
+        journalSetBase(filename);
+        return;
+    }
+    
+    size_t keep = j->bytes - mark;
+    char *tail = malloc(keep);
+    ssize_t got = pread(j->fd, tail, keep, sizeof(struct journalHeader) + mark);
+    if (got != (ssize_t)keep) {
+        if (got >= 0) errno = EIO;
+        free(tail);
+        journalFail();
+        return;
+    }
+    
+    char *old = j->path;
+    j->path = NULL;
+    journalSetBase(filename);
+    size_t tmplen = strlen(j->path) + 8;
+    char *tmp = malloc(tmplen);
+    snprintf(tmp, tmplen, "%s.XXXXXX", j->path);
+    
+    int fd = mkstemp(tmp);
+    if (fd == -1 || journalWriteAll(fd, (char *)&j->base, sizeof(j->base)) < 0 ||
+        journalWriteAll(fd, tail, keep) < 0 || fdatasync(fd) < 0 || rename(tmp, j->path) < 0) {
+        int err = errno;
+        if (fd != -1) {
+            close(fd);
+            unlink(tmp);
+        }
+        free(j->path);
+        j->path = old;
+        errno = err;
+        journalFail();
+    } else {
+        editorSyncDir(j->path);
+        close(j->fd);
+        if (strcmp(old, j->path) != 0) unlink(old);
+        free(old);
+        j->fd = fd;
+        j->bytes = keep;
+    }
+    free(tmp);
+    free(tail);
+}
+
+// Remove the journal: the buffer is being closed on purpose
+void editorJournalClose() {
+    struct journalState *j = journalGet();
+    
+    journalSyncReap(1);
+    if (j->fd != -1) {
+        close(j->fd);
+        unlink(j->path);
+    }
+    j->fd = -1;
+    j->len = 0;
+    j->unsynced = 0;
+    j->bytes = 0;
+    free(j->path);
+    j->path = NULL;
+}
+
+// Free the journal along with the buffer it belongs to, removing it
+void editorJournalFree() {
+    if (!E.journal) return;
+    
+    editorJournalClose();
+    free(E.journal->buf);
+    free(E.journal);
+    E.journal = NULL;
+}
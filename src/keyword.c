@@ -0,0 +1,176 @@
+#include "axcode.h"
+
+// The keywords, types, control keywords and word operators of a syntax are
+// compiled into one perfect hash built by hash and displace: keywords are
+// first spread over small buckets, then every bucket, biggest first, gets a
+// displacement that sends each of its keywords to a slot of its own. A
+// lookup is one hash of the word and one probe, however many keywords the
+// syntax has.
+struct keywordEntry {
+    const char *word;   // NULL if the slot is empty
+    int len;
+    int color;
+};
+
+static uint64_t keywordHash(const char *s, int len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint32_t keywordBucket(keywordTable *t, uint64_t h) {
+    return (h >> 48) & (t->nbuckets - 1);
+}
+
+static uint32_t keywordSlot(keywordTable *t, uint64_t h, uint32_t d) {
+    return ((uint32_t)h + d * ((uint32_t)(h >> 24) | 1)) & (t->size - 1);
+}
+
+struct keywordBucketSize {
+    int bucket;
+    int n;
+};
+
+static int keywordBySize(const void *a, const void *b) {
+    return ((const struct keywordBucketSize *)b)->n - ((const struct keywordBucketSize *)a)->n;
+}
+
+// Find a displacement for every bucket with t->size slots; fails if some
+// bucket cannot be placed, in which case more slots are needed
+static int keywordPlace(keywordTable *t, struct keywordEntry *entries, uint64_t *hash, int n) {
+    int nb = t->nbuckets;
+    struct keywordBucketSize *order = calloc(nb, sizeof(*order));
+    int *first = calloc(nb + 1, sizeof(int));
+    int *members = malloc(sizeof(int) * n);
+    uint32_t *slot = malloc(sizeof(uint32_t) * n);
+    int ok = 1;
+    
+    // Group the keywords by bucket
+    for (int i = 0; i < n; i++) first[keywordBucket(t, hash[i]) + 1]++;
+    for (int b = 0; b < nb; b++) {
+        order[b].bucket = b;
+        order[b].n = first[b + 1];
+        first[b + 1] += first[b];
+    }
+    int *fill = calloc(nb, sizeof(int));
+    for (int i = 0; i < n; i++) {
+        int b = keywordBucket(t, hash[i]);
+        members[first[b] + fill[b]++] = i;
+    }
+    free(fill);
+    qsort(order, nb, sizeof(*order), keywordBySize);
+    
+    for (int o = 0; o < nb && order[o].n > 0 && ok; o++) {
+        int b = order[o].bucket;
+        int *keys = &members[first[b]];
+        uint32_t d;
+        
+        for (d = 0; d < (uint32_t)t->size * 4; d++) {
+            int k;
+            for (k = 0; k < order[o].n; k++) {
+                slot[k] = keywordSlot(t, hash[keys[k]], d);
+                if (t->slots[slot[k]].word) break;
+                
+                // Two keywords of the bucket may not share a slot either
+                int j;
+                for (j = 0; j < k && slot[j] != slot[k]; j++);
+                if (j < k) break;
+            }
+            if (k == order[o].n) break;
+        }
+        
+        if (d == (uint32_t)t->size * 4) {
+            ok = 0;
+            break;
+        }
+        t->disp[b] = d;
+        for (int k = 0; k < order[o].n; k++)
+            t->slots[slot[k]] = entries[keys[k]];
+    }
+    
+    free(order);
+    free(first);
+    free(members);
+    free(slot);
+    return ok;
+}
+
+void keywordCompile(keywordTable *t, struct editorSyntax *syntax) {
+    char **lists[] = {
+        syntax->operator_patterns, syntax->keywords,
+        syntax->type_keywords, syntax->control_keywords
+    };
+    int colors[] = { COLOR_OPERATOR, COLOR_KEYWORD, COLOR_TYPE, COLOR_CONTROL };
+    int n = 0;
+    
+    for (int l = 0; l < 4; l++)
+        for (int j = 0; lists[l] && lists[l][j]; j++) n++;
+    
+    struct keywordEntry *entries = malloc(sizeof(*entries) * (n ? n : 1));
+    uint64_t *hash = malloc(sizeof(uint64_t) * (n ? n : 1));
+    n = 0;
+    t->maxlen = 0;
+    
+    // A trailing '|' marks the second kind of a list: types among the
+    // keywords and booleans among the operators. A word listed twice keeps
+    // the color of its first list.
+    for (int l = 0; l < 4; l++) {
+        for (int j = 0; lists[l] && lists[l][j]; j++) {
+            const char *word = lists[l][j];
+            int len = strlen(word);
+            int color = colors[l];
+            
+            if (len > 0 && word[len - 1] == '|') {
+                len--;
+                if (l == 0) color = COLOR_BOOLEAN;
+                if (l == 1) color = COLOR_TYPE;
+            }
+            if (len == 0) continue;
+            
+            int k;
+            for (k = 0; k < n; k++)
+                if (entries[k].len == len && memcmp(entries[k].word, word, len) == 0) break;
+            if (k < n) continue;
+            
+            entries[n].word = word;
+            entries[n].len = len;
+            entries[n].color = color;
+            hash[n++] = keywordHash(word, len);
+            if (len > t->maxlen) t->maxlen = len;
+        }
+    }
+    
+    // Keep the table about 80% full, doubling it in the rare case that
+    // some bucket finds no displacement
+    int size = 1;
+    while (size < n + n / 4) size *= 2;
+    int nb = 1;
+    while (nb * 4 < n) nb *= 2;
+    
+    t->nbuckets = nb;
+    t->disp = calloc(nb, sizeof(uint32_t));
+    t->slots = NULL;
+    for (t->size = size; ; t->size *= 2) {
+        free(t->slots);
+        t->slots = calloc(t->size, sizeof(struct keywordEntry));
+        if (keywordPlace(t, entries, hash, n)) break;
+    }
+    
+    free(entries);
+    free(hash);
+}
+
+int keywordFind(keywordTable *t, const char *s, int len) {
+    if (len > t->maxlen || !t->slots) return 0;
+    
+    uint64_t h = keywordHash(s, len);
+    struct keywordEntry *e = &t->slots[keywordSlot(t, h, t->disp[keywordBucket(t, h)])];
+    if (e->word && e->len == len && memcmp(e->word, s, len) == 0) return e->color;
+    return 0;
+}
@@ -3,15 +3,20 @@
 int main(int argc, char *argv[]) {
     // Initialize editor
     initEditor();
+    editorSyntaxStartWorker();
     
-    // If filename provided, open it
-    if (argc >= 2) {
-        editorOpen(argv[1]);
-    }
-    
-    // Set initial status message
+    // Set initial status message, unless opening the file leaves one
     editorSetStatusMessage("HELP: Ctrl-Q = quit | Ctrl-S = save | ESC = normal mode");
     
+    // Files named on the command line become buffers, each read when it is
+    // first visited
+    int first = -1;
+    for (int i = 1; i < argc; i++) {
+        int b = editorBufferAdd(argv[i]);
+        if (first < 0) first = b;
+    }
+    if (first >= 0) editorBufferSwitch(first);
+    
     // Main editor loop
     while (1) {
         editorRefreshScreen();
@@ -0,0 +1,856 @@
+#include "axcode.h"
+
+// Regular expressions in the syntax vi takes after \v: literals, ., []
+// classes, \d \w \s and their negations, ^ and $, groups, | and the
+// * + ? {n,m} repeats. A pattern is parsed into a tree and compiled into a
+// Thompson NFA. Text is first scanned for lines that hold a match by
+// running the NFA as a DFA whose states are built lazily, the first time
+// the text leads to them, so scanning costs a table lookup per byte. Where
+// a match starts and ends in such a line is then worked out by simulating
+// the NFA, leftmost and longest as in POSIX.
+#define REGEX_MAX_PROG 65536    // NFA instructions a pattern may compile to
+#define REGEX_MAX_STATES 2048   // DFA states kept before all are dropped
+#define REGEX_MAX_LITERAL 64
+#define REGEX_MIN_LITERAL 3     // Shorter literals are too common to look for
+
+enum regexOp {
+    RX_SET,             // Take a byte of set and go on to x
+    RX_JMP,
+    RX_SPLIT,           // Go on to both x and y
+    RX_BOL,             // Go on to x at the start of the line
+    RX_EOL,             // Go on to x at the end of the line
+    RX_MATCH
+};
+
+typedef struct rxSet {
+    uint64_t bits[4];
+} rxSet;
+
+struct rxInst {
+    int op;
+    int x, y;
+    int set;            // Index in sets of the bytes an RX_SET takes
+};
+
+struct regex {
+    struct rxInst *prog;
+    int n, cap;
+    rxSet *sets;
+    int nsets, setcap;
+    int start;
+    unsigned char cls[256]; // Class of every byte
+    unsigned char rep[256]; // A byte of every class
+    int nclasses;
+    char lit[REGEX_MAX_LITERAL]; // Text every match holds, if litlen > 0
+    int litlen;
+    struct rxThread *threads; // regexFind's two thread lists of n each,
+    int *mark;          // the generation each instruction was last added in
+    int *stack;         // and the instructions still to add, kept between calls
+    int gen;
+};
+
+// Parse tree
+enum rxNodeType { RXN_SET, RXN_CAT, RXN_ALT, RXN_REPEAT, RXN_BOL, RXN_EOL, RXN_EMPTY };
+
+struct rxNode {
+    int type;
+    int min, max;       // Repeat counts, max -1 for no limit
+    rxSet set;
+    struct rxNode *a, *b;
+};
+
+struct rxParser {
+    const char *p;
+    const char *err;
+};
+
+static void setAdd(rxSet *s, int c) {
+    s->bits[c >> 6] |= 1ULL << (c & 63);
+}
+
+static int setHas(const rxSet *s, int c) {
+    return (s->bits[c >> 6] >> (c & 63)) & 1;
+}
+
+static void setRange(rxSet *s, int from, int to) {
+    for (int c = from; c <= to; c++) setAdd(s, c);
+}
+
+static void setInvert(rxSet *s) {
+    for (int i = 0; i < 4; i++) s->bits[i] = ~s->bits[i];
+}
+
+static void setUnion(rxSet *s, const rxSet *t) {
+    for (int i = 0; i < 4; i++) s->bits[i] |= t->bits[i];
+}
+
+static struct rxNode *nodeNew(int type, struct rxNode *a, struct rxNode *b) {
+    struct rxNode *n = calloc(1, sizeof(*n));
+    n->type = type;
+    n->a = a;
+    n->b = b;
+    return n;
+}
+
+static void nodeFree(struct rxNode *n) {
+    if (!n) return;
+    nodeFree(n->a);
+    nodeFree(n->b);
+    free(n);
+}
+
+// The class named by \c, if it is one of \d \w \s or their negations
+static int parseClassEscape(int c, rxSet *s) {
+    memset(s, 0, sizeof(*s));
+    switch (tolower(c)) {
+        case 'd':
+            setRange(s, '0', '9');
+            break;
+        case 'w':
+            setRange(s, '0', '9');
+            setRange(s, 'a', 'z');
+            setRange(s, 'A', 'Z');
+            setAdd(s, '_');
+            break;
+        case 's':
+            setAdd(s, ' ');
+            setAdd(s, '\t');
+            setAdd(s, '\v');
+            setAdd(s, '\f');
+            setAdd(s, '\r');
+            break;
+        default:
+            return 0;
+    }
+    if (isupper(c)) setInvert(s);
+    return 1;
+}
+
+static int parseEscapedByte(int c) {
+    if (c == 't') return '\t';
+    if (c == 'e') return 27;
+    return c;
+}
+
+static struct rxNode *parseAlt(struct rxParser *ps);
+
+static struct rxNode *parseClass(struct rxParser *ps) {
+    struct rxNode *n = nodeNew(RXN_SET, NULL, NULL);
+    int negate = 0;
+    
+    if (*ps->p == '^') {
+        negate = 1;
+        ps->p++;
+    }
+    for (int first = 1; *ps->p && (first || *ps->p != ']'); first = 0) {
+        int c = (unsigned char)*ps->p++;
+        rxSet esc;
+        
+        if (c == '\\' && *ps->p) {
+            c = (unsigned char)*ps->p++;
+            if (parseClassEscape(c, &esc)) {
+                setUnion(&n->set, &esc);
+                continue;
+            }
+            c = parseEscapedByte(c);
+        }
+        if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+            int to = (unsigned char)ps->p[1];
+            ps->p += 2;
+            if (to == '\\' && *ps->p) to = parseEscapedByte((unsigned char)*ps->p++);
+            if (to < c) {
+                ps->err = "Reverse range in []";
+                return n;
+            }
+            setRange(&n->set, c, to);
+        } else {
+            setAdd(&n->set, c);
+        }
+    }
+    if (*ps->p != ']') {
+        ps->err = "Missing ]";
+        return n;
+    }
+    ps->p++;
+    
+    if (negate) setInvert(&n->set);
+    return n;
+}
+
+static struct rxNode *parseAtom(struct rxParser *ps) {
+    int c = (unsigned char)*ps->p++;
+    struct rxNode *n;
+    
+    switch (c) {
+        case '(':
+            n = parseAlt(ps);
+            if (*ps->p != ')') {
+                if (!ps->err) ps->err = "Missing )";
+                return n;
+            }
+            ps->p++;
+            return n;
+        case '[':
+            return parseClass(ps);
+        case '^':
+            return nodeNew(RXN_BOL, NULL, NULL);
+        case '$':
+            return nodeNew(RXN_EOL, NULL, NULL);
+        case '.':
+            n = nodeNew(RXN_SET, NULL, NULL);
+            setInvert(&n->set);
+            return n;
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            ps->err = "Nothing to repeat";
+            return nodeNew(RXN_EMPTY, NULL, NULL);
+    }
+    
+    n = nodeNew(RXN_SET, NULL, NULL);
+    if (c == '\\') {
+        if (!*ps->p) {
+            ps->err = "Trailing \\";
+            return n;
+        }
+        c = (unsigned char)*ps->p++;
+        if (parseClassEscape(c, &n->set)) return n;
+        c = parseEscapedByte(c);
+    }
+    setAdd(&n->set, c);
+    return n;
+}
+
+static int parseNumber(struct rxParser *ps, int *v) {
+    if (!isdigit((unsigned char)*ps->p)) return 0;
+    for (*v = 0; isdigit((unsigned char)*ps->p); ps->p++)
+        if (*v < 10000) *v = *v * 10 + (*ps->p - '0');
+    return 1;
+}
+
+// {n}, {n,}, {,m} or {n,m}
+static void parseBraces(struct rxParser *ps, int *min, int *max) {
+    *min = 0;
+    *max = -1;
+    int hasmin = parseNumber(ps, min);
+    if (*ps->p == ',') {
+        ps->p++;
+        parseNumber(ps, max);
+    } else if (hasmin) {
+        *max = *min;
+    }
+    if (*ps->p != '}') {
+        ps->err = "Missing }";
+        return;
+    }
+    ps->p++;
+    if (*max != -1 && *max < *min) ps->err = "Bad {} range";
+}
+
+static struct rxNode *parseRepeat(struct rxParser *ps) {
+    struct rxNode *n = parseAtom(ps);
+    
+    while (!ps->err && *ps->p && strchr("*+?{", *ps->p)) {
+        struct rxNode *r = nodeNew(RXN_REPEAT, n, NULL);
+        char c = *ps->p++;
+        
+        r->min = c == '+' ? 1 : 0;
+        r->max = c == '?' ? 1 : -1;
+        if (c == '{') parseBraces(ps, &r->min, &r->max);
+        n = r;
+    }
+    return n;
+}
+
+static struct rxNode *parseCat(struct rxParser *ps) {
+    struct rxNode *n = nodeNew(RXN_EMPTY, NULL, NULL);
+    
+    while (!ps->err && *ps->p && *ps->p != '|' && *ps->p != ')')
+        n = nodeNew(RXN_CAT, n, parseRepeat(ps));
+    return n;
+}
+
+static struct rxNode *parseAlt(struct rxParser *ps) {
+    struct rxNode *n = parseCat(ps);
+    
+    while (!ps->err && *ps->p == '|') {
+        ps->p++;
+        n = nodeNew(RXN_ALT, n, parseCat(ps));
+    }
+    return n;
+}
+
+static int progEmit(regex *re, int op, int x, int y) {
+    if (re->n == re->cap) {
+        re->cap = re->cap ? re->cap * 2 : 64;
+        re->prog = realloc(re->prog, sizeof(struct rxInst) * re->cap);
+    }
+    struct rxInst *in = &re->prog[re->n];
+    in->op = op;
+    in->x = x;
+    in->y = y;
+    in->set = -1;
+    return re->n++;
+}
+
+static int progSet(regex *re, const rxSet *s, int next) {
+    if (re->nsets == re->setcap) {
+        re->setcap = re->setcap ? re->setcap * 2 : 16;
+        re->sets = realloc(re->sets, sizeof(rxSet) * re->setcap);
+    }
+    re->sets[re->nsets] = *s;
+    int pc = progEmit(re, RX_SET, next, 0);
+    re->prog[pc].set = re->nsets++;
+    return pc;
+}
+
+// Compile n so that it carries on to next; returns where it starts, or -1
+// if the program grows too big. Repeats are compiled as copies of their
+// body, the optional ones nested.
+static int progCompile(regex *re, struct rxNode *n, int next) {
+    int pc;
+    
+    if (next < 0 || re->n > REGEX_MAX_PROG) return -1;
+    switch (n->type) {
+        case RXN_SET:
+            return progSet(re, &n->set, next);
+        case RXN_CAT:
+            return progCompile(re, n->a, progCompile(re, n->b, next));
+        case RXN_ALT: {
+            int a = progCompile(re, n->a, next);
+            int b = progCompile(re, n->b, next);
+            return a < 0 || b < 0 ? -1 : progEmit(re, RX_SPLIT, a, b);
+        }
+        case RXN_BOL:
+            return progEmit(re, RX_BOL, next, 0);
+        case RXN_EOL:
+            return progEmit(re, RX_EOL, next, 0);
+        case RXN_REPEAT:
+            pc = next;
+            if (n->max == -1) {
+                int loop = progEmit(re, RX_SPLIT, 0, next);
+                int body = progCompile(re, n->a, loop);
+                if (body < 0) return -1;
+                re->prog[loop].x = body;
+                pc = loop;
+            } else {
+                for (int i = n->min; i < n->max && pc >= 0; i++) {
+                    int body = progCompile(re, n->a, pc);
+                    pc = body < 0 ? -1 : progEmit(re, RX_SPLIT, body, next);
+                }
+            }
+            for (int i = 0; i < n->min && pc >= 0; i++)
+                pc = progCompile(re, n->a, pc);
+            return pc;
+    }
+    return next;
+}
+
+// Split the classes of the bytes by whether they are in set
+static void regexRefine(regex *re, const rxSet *set) {
+    int map[256][2];
+    int n = 0;
+    
+    memset(map, -1, sizeof(map));
+    for (int c = 0; c < 256; c++) {
+        int *to = &map[re->cls[c]][setHas(set, c)];
+        if (*to < 0) *to = n++;
+        re->cls[c] = *to;
+    }
+    re->nclasses = n;
+}
+
+// Split the bytes into classes that no set tells apart, with '\n' and '\r'
+// in classes of their own since scanning stops for them
+static void regexClasses(regex *re) {
+    rxSet nl = {{0}}, cr = {{0}};
+    
+    memset(re->cls, 0, sizeof(re->cls));
+    re->nclasses = 1;
+    setAdd(&nl, '\n');
+    setAdd(&cr, '\r');
+    regexRefine(re, &nl);
+    regexRefine(re, &cr);
+    for (int s = 0; s < re->nsets; s++) regexRefine(re, &re->sets[s]);
+    for (int c = 255; c >= 0; c--) re->rep[re->cls[c]] = c;
+}
+
+static int setSingle(const rxSet *s) {
+    int n = 0;
+    for (int i = 0; i < 4; i++) n += __builtin_popcountll(s->bits[i]);
+    return n == 1;
+}
+
+// Find the longest run of single bytes that every match of n holds, as the
+// ERROR in ERROR.*timeout; lit[0, len) is the run being followed
+static void literalFind(regex *re, struct rxNode *n, char *lit, int *len) {
+    switch (n->type) {
+        case RXN_SET:
+            if (!setSingle(&n->set) || *len == REGEX_MAX_LITERAL) {
+                *len = 0;
+                break;
+            }
+            for (int c = 0; c < 256; c++)
+                if (setHas(&n->set, c)) lit[(*len)++] = c;
+            if (*len > re->litlen) {
+                memcpy(re->lit, lit, *len);
+                re->litlen = *len;
+            }
+            break;
+        case RXN_CAT:
+            literalFind(re, n->a, lit, len);
+            literalFind(re, n->b, lit, len);
+            break;
+        case RXN_REPEAT:
+            // The first time round is certain, what follows it is not
+            if (n->min > 0) literalFind(re, n->a, lit, len);
+            *len = 0;
+            break;
+        case RXN_ALT:
+            *len = 0;
+            break;
+    }
+}
+
+regex *regexCompile(const char *pattern, const char **err) {
+    struct rxParser ps = { pattern, NULL };
+    struct rxNode *tree = parseAlt(&ps);
+    
+    if (!ps.err && *ps.p == ')') ps.err = "Unmatched )";
+    if (ps.err) {
+        nodeFree(tree);
+        *err = ps.err;
+        return NULL;
+    }
+    
+    regex *re = calloc(1, sizeof(*re));
+    char lit[REGEX_MAX_LITERAL];
+    int litlen = 0;
+    
+    literalFind(re, tree, lit, &litlen);
+    if (re->litlen < REGEX_MIN_LITERAL) re->litlen = 0;
+    re->start = progCompile(re, tree, progEmit(re, RX_MATCH, 0, 0));
+    nodeFree(tree);
+    if (re->start < 0) {
+        regexFree(re);
+        *err = "Pattern too big";
+        return NULL;
+    }
+    regexClasses(re);
+    return re;
+}
+
+void regexFree(regex *re) {
+    if (!re) return;
+    free(re->prog);
+    free(re->sets);
+    free(re->threads);
+    free(re->mark);
+    free(re->stack);
+    free(re);
+}
+
+// NFA simulation
+
+struct rxThread {
+    int pc;
+    int start;
+};
+
+struct rxList {
+    struct rxThread *t;
+    int n;
+};
+
+// Add the thread at pc and everything it reaches without taking a byte;
+// the first thread to reach an instruction keeps it
+static void simAdd(const regex *re, struct rxList *l, int *mark, int gen, int *stack,
+                   int pc, int start, int bol, int eol) {
+    int sp = 0;
+
+    stack[sp++] = pc;
+    while (sp > 0) {
+        pc = stack[--sp];
+        if (mark[pc] == gen) continue;
+        mark[pc] = gen;
+
+        struct rxInst *in = &re->prog[pc];
+        switch (in->op) {
+            case RX_JMP:
+                stack[sp++] = in->x;
+                break;
+            case RX_SPLIT:
+                stack[sp++] = in->y;
+                stack[sp++] = in->x;
+                break;
+            case RX_BOL:
+                if (bol) stack[sp++] = in->x;
+                break;
+            case RX_EOL:
+                if (eol) stack[sp++] = in->x;
+                break;
+            default:
+                l->t[l->n].pc = pc;
+                l->t[l->n++].start = start;
+                break;
+        }
+    }
+}
+
+// Leftmost longest match in s[0, len) starting at from or after it. Returns
+// where it starts, or -1 if there is none; *mlen is set to its length. The
+// scratch arrays are kept in re, so a regex is searched by one thread at a
+// time, as a regexDFA is.
+int regexFind(regex *re, const char *s, int len, int from, int *mlen) {
+    if (!re->threads) {
+        re->threads = malloc(sizeof(struct rxThread) * re->n * 2);
+        re->mark = calloc(re->n, sizeof(int));
+        re->stack = malloc(sizeof(int) * re->n * 2);
+    }
+    // Two generations a byte; start over before they run out
+    if (re->gen > INT_MAX - 2 * (len - from + 2)) {
+        memset(re->mark, 0, sizeof(int) * re->n);
+        re->gen = 0;
+    }
+    
+    struct rxList cur = { re->threads, 0 }, nxt = { re->threads + re->n, 0 };
+    int *mark = re->mark, *stack = re->stack;
+    int gen = re->gen;
+    int best = -1, bestend = -1;
+    
+    for (int pos = from; pos <= len; pos++) {
+        // Threads are kept in the order they started, so a new one, which
+        // starts last, goes at the end
+        gen++;
+        for (int i = 0; i < cur.n; i++) mark[cur.t[i].pc] = gen;
+        if (best < 0) simAdd(re, &cur, mark, gen, stack, re->start, pos, pos == 0, pos == len);
+        if (cur.n == 0 && best >= 0) break;
+        
+        for (int i = 0; i < cur.n; i++) {
+            struct rxThread *t = &cur.t[i];
+            if (re->prog[t->pc].op != RX_MATCH) continue;
+            if (best < 0 || t->start < best || (t->start == best && pos > bestend)) {
+                best = t->start;
+                bestend = pos;
+            }
+        }
+        if (pos == len) break;
+        
+        gen++;
+        nxt.n = 0;
+        unsigned char c = s[pos];
+        for (int i = 0; i < cur.n; i++) {
+            struct rxThread *t = &cur.t[i];
+            struct rxInst *in = &re->prog[t->pc];
+            if (best >= 0 && t->start > best) continue;
+            if (in->op == RX_SET && setHas(&re->sets[in->set], c))
+                simAdd(re, &nxt, mark, gen, stack, in->x, t->start, 0, pos + 1 == len);
+        }
+        
+        struct rxList tmp = cur;
+        cur = nxt;
+        nxt = tmp;
+    }
+    
+    re->gen = gen;
+    if (best >= 0) *mlen = bestend - best;
+    return best;
+}
+
+// Lazy DFA
+
+#define RX_ACCEPT 1         // A match ends here
+#define RX_EOL_ACCEPT 2     // A match ends here if the line does
+#define RX_DEAD 4           // No match can be made in the rest of the line
+
+struct rxState {
+    int flags;
+    int n;
+    unsigned hash;
+    int *next;          // State after every byte class, -1 until needed
+    int *insts;         // RX_SET, RX_EOL and RX_MATCH instructions, sorted,
+                        // and -1 in the state at the start of a line
+};
+
+struct regexDFA {
+    const regex *re;
+    struct rxState **states;
+    int n;
+    int *table;         // Open addressing table of state numbers
+    int tsize;
+    int *mark, gen;     // Scratch for working out states
+    int *stack, *set;
+    int start;          // State at the start of a line
+    int *trans;         // Transitions the scan can take without stopping,
+                        // by state * nclasses + class; -1 for the others
+};
+
+static int intCmp(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// Add the instructions pc reaches without taking a byte to d->set
+static void dfaAdd(regexDFA *d, int *n, int pc, int bol, int eol) {
+    const regex *re = d->re;
+    int sp = 0;
+    
+    d->stack[sp++] = pc;
+    while (sp > 0) {
+        pc = d->stack[--sp];
+        if (d->mark[pc] == d->gen) continue;
+        d->mark[pc] = d->gen;
+        
+        struct rxInst *in = &re->prog[pc];
+        if (in->op == RX_JMP) {
+            d->stack[sp++] = in->x;
+        } else if (in->op == RX_SPLIT) {
+            d->stack[sp++] = in->x;
+            d->stack[sp++] = in->y;
+        } else if (in->op == RX_BOL) {
+            if (bol) d->stack[sp++] = in->x;
+        } else if (in->op == RX_EOL && eol) {
+            d->stack[sp++] = in->x;
+        } else {
+            d->set[(*n)++] = pc;
+        }
+    }
+}
+
+// Whether a match ends at the end of the line for a state holding insts;
+// bol if the line may be empty
+static int dfaEolAccepts(regexDFA *d, const int *insts, int n, int bol) {
+    int m = 0;
+    
+    d->gen++;
+    for (int i = 0; i < n; i++)
+        if (insts[i] >= 0 && d->re->prog[insts[i]].op == RX_EOL) dfaAdd(d, &m, d->re->prog[insts[i]].x, bol, 1);
+    for (int i = 0; i < m; i++)
+        if (d->re->prog[d->set[i]].op == RX_MATCH) return 1;
+    return 0;
+}
+
+static void dfaTableInsert(regexDFA *d, int id) {
+    unsigned i = d->states[id]->hash & (d->tsize - 1);
+    while (d->table[i] >= 0) i = (i + 1) & (d->tsize - 1);
+    d->table[i] = id;
+}
+
+// The state for the n instructions in d->set, made if it is new. Returns
+// -1 if there is no room for more states.
+static int dfaState(regexDFA *d, int n) {
+    unsigned h = 2166136261u;
+    
+    qsort(d->set, n, sizeof(int), intCmp);
+    for (int i = 0; i < n; i++) h = (h ^ d->set[i]) * 16777619u;
+    
+    unsigned i = h & (d->tsize - 1);
+    for (; d->table[i] >= 0; i = (i + 1) & (d->tsize - 1)) {
+        struct rxState *s = d->states[d->table[i]];
+        if (s->hash == h && s->n == n && memcmp(s->insts, d->set, sizeof(int) * n) == 0)
+            return d->table[i];
+    }
+    if (d->n == REGEX_MAX_STATES) return -1;
+    
+    int nc = d->re->nclasses;
+    struct rxState *s = malloc(sizeof(*s) + sizeof(int) * (nc + n));
+    s->next = (int *)(s + 1);
+    s->insts = s->next + nc;
+    s->n = n;
+    s->hash = h;
+    s->flags = n == 0 ? RX_DEAD : 0;
+    memset(s->next, -1, sizeof(int) * nc);
+    memcpy(s->insts, d->set, sizeof(int) * n);
+    
+    for (int k = 0; k < n; k++)
+        if (s->insts[k] >= 0 && d->re->prog[s->insts[k]].op == RX_MATCH) s->flags = RX_ACCEPT | RX_EOL_ACCEPT;
+    if (!s->flags && dfaEolAccepts(d, s->insts, n, 0)) s->flags = RX_EOL_ACCEPT;
+    
+    d->states[d->n] = s;
+    dfaTableInsert(d, d->n);
+    memset(&d->trans[d->n * nc], -1, sizeof(int) * nc);
+    return d->n++;
+}
+
+// Drop every state but the one at the start of a line and state keep,
+// if it is not -1; returns the new number of keep
+static int dfaReset(regexDFA *d, int keep) {
+    int *insts = NULL, nkeep = 0;
+    
+    if (keep >= 0) {
+        nkeep = d->states[keep]->n;
+        insts = malloc(sizeof(int) * nkeep);
+        memcpy(insts, d->states[keep]->insts, sizeof(int) * nkeep);
+    }
+    for (int i = 0; i < d->n; i++) free(d->states[i]);
+    d->n = 0;
+    memset(d->table, -1, sizeof(int) * d->tsize);
+    
+    int n = 0;
+    d->gen++;
+    dfaAdd(d, &n, d->re->start, 1, 0);
+    d->set[n++] = -1;   // Keeps it apart from states with the same instructions
+    d->start = dfaState(d, n);
+    
+    // The start of an empty line is its end too, as for ^$
+    struct rxState *s = d->states[d->start];
+    if (dfaEolAccepts(d, s->insts, s->n, 1)) s->flags |= RX_EOL_ACCEPT;
+    
+    if (keep < 0) return -1;
+    memcpy(d->set, insts, sizeof(int) * nkeep);
+    free(insts);
+    return dfaState(d, nkeep);
+}
+
+regexDFA *regexDFANew(const regex *re) {
+    regexDFA *d = calloc(1, sizeof(*d));
+    
+    d->re = re;
+    d->states = malloc(sizeof(struct rxState *) * REGEX_MAX_STATES);
+    d->tsize = REGEX_MAX_STATES * 2;
+    d->table = malloc(sizeof(int) * d->tsize);
+    d->mark = calloc(re->n, sizeof(int));
+    d->stack = malloc(sizeof(int) * re->n * 2);
+    d->set = malloc(sizeof(int) * (re->n + 1));
+    d->trans = malloc(sizeof(int) * REGEX_MAX_STATES * re->nclasses);
+    dfaReset(d, -1);
+    return d;
+}
+
+void regexDFAFree(regexDFA *d) {
+    if (!d) return;
+    for (int i = 0; i < d->n; i++) free(d->states[i]);
+    free(d->states);
+    free(d->table);
+    free(d->mark);
+    free(d->stack);
+    free(d->set);
+    free(d->trans);
+    free(d);
+}
+
+// The state after state id takes a byte of class c. A match may start
+// anywhere, so the start of the pattern is added back in at every byte.
+static int dfaStep(regexDFA *d, int id, int c) {
+    struct rxState *s = d->states[id];
+    const regex *re = d->re;
+    int b = re->rep[c];
+    int n = 0;
+    
+    d->gen++;
+    for (int i = 0; i < s->n; i++) {
+        if (s->insts[i] < 0) continue;
+        struct rxInst *in = &re->prog[s->insts[i]];
+        if (in->op == RX_SET && setHas(&re->sets[in->set], b)) dfaAdd(d, &n, in->x, 0, 0);
+    }
+    dfaAdd(d, &n, re->start, 0, 0);
+    
+    int next = dfaState(d, n);
+    if (next < 0) return -1;
+    d->states[id]->next[c] = next;
+    
+    // Line breaks, matches and dead ends need a look, the rest can be run
+    // through
+    if (!(d->states[next]->flags & (RX_ACCEPT | RX_DEAD)) && c != re->cls['\n'] && c != re->cls['\r'])
+        d->trans[id * re->nclasses + c] = next * re->nclasses;
+    return next;
+}
+
+static void linesPush(size_t **lines, int *n, int *cap, size_t line) {
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *lines = realloc(*lines, sizeof(size_t) * *cap);
+    }
+    (*lines)[(*n)++] = line;
+}
+
+// Run the DFA over the lines of [p, end), adding the offsets from text of
+// those it takes
+static void dfaScan(regexDFA *d, const unsigned char *p, const unsigned char *end,
+                    const char *text, size_t **lines, int *n, int *cap) {
+    const unsigned char *cls = d->re->cls;
+    const unsigned char *line = p;
+    const unsigned char *crend = NULL; // Where the last run of '\r's ended
+    int nc = d->re->nclasses;
+    int s = d->start, beforecr = -1; // State before that run
+    
+    while (1) {
+        int take;
+        
+        if (d->states[s]->flags & RX_ACCEPT) {
+            take = 1;
+        } else {
+            // Run through the table until a byte needs a closer look
+            const int *trans = d->trans;
+            int at = s * nc;
+            while (p < end) {
+                int next = trans[at + cls[*p]];
+                if (next < 0) break;
+                at = next;
+                p++;
+            }
+            s = at / nc;
+            
+            if (p < end && *p != '\n') {
+                if (*p == '\r') {
+                    if (crend != p) beforecr = s;
+                    crend = p + 1;
+                }
+                int next = d->states[s]->next[cls[*p]];
+                if (next < 0) next = dfaStep(d, s, cls[*p]);
+                if (next < 0) {
+                    // Out of states: drop the others and carry on from this
+                    // one, unless the state before the '\r's goes with them
+                    s = dfaReset(d, s);
+                    if (crend != p + 1) continue;
+                    take = 1;
+                } else if ((d->states[next]->flags & RX_DEAD) && *p != '\r') {
+                    // As after the first byte of a line for ^foo; the state
+                    // before a '\r' may still match at the line break
+                    take = 0;
+                } else {
+                    s = next;
+                    p++;
+                    continue;
+                }
+            } else {
+                // The end of the line, not counting the '\r's before '\n'
+                take = d->states[crend == p ? beforecr : s]->flags & RX_EOL_ACCEPT;
+            }
+        }
+        
+        if (take) linesPush(lines, n, cap, (const char *)line - text);
+        p = p < end ? memchr(p, '\n', end - p) : NULL;
+        if (!p) return;
+        line = ++p;
+        s = d->start;
+        crend = NULL;
+    }
+}
+
+// Find the lines of text[0, len), which are split by '\n', that may hold a
+// match, and append the offsets they start at to *lines. Every line with a
+// match is found; a line is also taken if it only matches when the '\r' of
+// a "\r\n" line break is counted in, or the odd one that ran out of states
+// in the '\r's of its line break, so the lines found are to be checked with
+// regexFind(). If all matches hold some literal text, only the lines where
+// it turns up are run through the DFA.
+void regexScan(regexDFA *d, const char *text, size_t len, size_t **lines, int *n, int *cap) {
+    const regex *re = d->re;
+    const char *p = text, *end = text + len, *hit;
+    
+    if (re->litlen == 0) {
+        dfaScan(d, (const unsigned char *)text, (const unsigned char *)end, text, lines, n, cap);
+        return;
+    }
+    while ((hit = memmem(p, end - p, re->lit, re->litlen)) != NULL) {
+        const char *start = memrchr(p, '\n', hit - p);
+        const char *stop = memchr(hit, '\n', end - hit);
+        
+        start = start ? start + 1 : p;
+        stop = stop ? stop : end;
+        dfaScan(d, (const unsigned char *)start, (const unsigned char *)stop, text, lines, n, cap);
+        if (stop == end) break;
+        p = stop + 1;
+    }
+}
@@ -1,41 +1,274 @@
 #include "axcode.h"
 
-// Global editor config
-struct editorConfig E;
+// Row text is a gap buffer: chars[0..gap) holds the text before the gap and
+// the last (size - gap) bytes of chars hold the text after it. Edits move the
+// gap to the cursor, so typing in one place costs amortized O(1).
+static void rowMoveGap(erow *row, int at) {
+    int gaplen = row->cap - row->size;
+    
+    if (at < row->gap) {
+        memmove(&row->chars[at + gaplen], &row->chars[at], row->gap - at);
+    } else if (at > row->gap) {
+        memmove(&row->chars[row->gap], &row->chars[row->gap + gaplen], at - row->gap);
+    }
+    row->gap = at;
+}
 
-void editorUpdateRow(erow *row) {
-    free(row->render);
-    row->render = malloc(row->size + 1);
+// Copy text that still points into the file mapping to the heap before
+// the row is changed
+static void rowOwn(erow *row) {
+    if (row->cap) return;
+    
+    char *chars = malloc(row->size + 1);
+    memcpy(chars, row->chars, row->size);
+    row->chars = chars;
+    row->cap = row->size + 1;
+    E.rowbytes += row->cap;
+    row->gap = row->size;
+}
+
+// Make room for extra more bytes, always keeping one spare byte so
+// editorRowChars() can terminate the text. Capacity grows geometrically.
+static void rowReserve(erow *row, int extra) {
+    rowOwn(row);
+    if (row->cap - row->size > extra) return;
+    
+    int cap = row->cap ? row->cap * 2 : 16;
+    while (cap - row->size <= extra) cap *= 2;
+    
+    int tail = row->size - row->gap;
+    row->chars = realloc(row->chars, cap);
+    memmove(&row->chars[cap - tail], &row->chars[row->cap - tail], tail);
+    E.rowbytes += cap - row->cap;
+    row->cap = cap;
+}
+
+char *editorRowChars(erow *row) {
+    rowOwn(row);
+    rowMoveGap(row, row->size);
+    row->chars[row->size] = '\0';
+    return row->chars;
+}
+
+// render and hl are gap buffers as well, sharing one gap and one capacity,
+// reused across updates. Their gap stays a little past where the row is
+// being typed into, so typing moves the text between the two rather than
+// all the text after the cursor, while the lexer still finds the text
+// around the edit in one piece.
+static void rowReserveRender(erow *row) {
+    if (row->rcap >= row->size + 1) return;
+    
+    int rcap = row->rcap ? row->rcap : 16;
+    while (rcap < row->size + 1) rcap *= 2;
+    
+    int tail = row->rsize - row->rgap;
+    row->render = realloc(row->render, rcap);
+    row->hl = realloc(row->hl, rcap);
+    memmove(&row->render[rcap - tail], &row->render[row->rcap - tail], tail);
+    memmove(&row->hl[rcap - tail], &row->hl[row->rcap - tail], tail);
+    E.rowbytes += 2 * (size_t)(rcap - row->rcap);
+    row->rcap = rcap;
+}
+
+static void rowMoveRenderGap(erow *row, int at) {
+    int gaplen = row->rcap - row->rsize;
     
-    int j = 0;
-    for (int i = 0; i < row->size; i++) {
-        row->render[j++] = row->chars[i];
+    if (at < row->rgap) {
+        memmove(&row->render[at + gaplen], &row->render[at], row->rgap - at);
+        memmove(&row->hl[at + gaplen], &row->hl[at], row->rgap - at);
+    } else if (at > row->rgap) {
+        memmove(&row->render[row->rgap], &row->render[row->rgap + gaplen], at - row->rgap);
+        memmove(&row->hl[row->rgap], &row->hl[row->rgap + gaplen], at - row->rgap);
     }
+    row->rgap = at;
+    if (at == row->rsize) row->render[at] = '\0';
+}
+
+// Have render and hl in one piece up to end, for code reading them
+// directly; the whole row takes end set to rsize
+void editorRowRenderUpTo(erow *row, int end) {
+    if (end > row->rsize) end = row->rsize;
+    if (row->render && row->rgap < end) rowMoveRenderGap(row, end);
+}
+
+void editorUpdateRow(erow *row) {
+    row->rsize = row->rgap = 0;
+    rowReserveRender(row);
     
-    row->render[j] = '\0';
-    row->rsize = j;
+    int tail = row->size - row->gap;
+    memcpy(row->render, row->chars, row->gap);
+    memcpy(&row->render[row->gap], &row->chars[row->cap - tail], tail);
+    
+    row->render[row->size] = '\0';
+    row->rsize = row->rgap = row->size;
     
     editorUpdateSyntax(row);
 }
 
+// Re-render a row after its text changed and pass on any change to the
+// lexer state it hands to the next row
+static void rowChanged(erow *row) {
+    int out = row->render ? row->hl_open_comment : -1;
+    
+    editorUpdateRow(row);
+    editorSyntaxRowChanged(row, out);
+    
+    int at = editorRowIndex(row);
+    editorDamageRows(at, at);
+}
+
+// Re-render a row after len bytes were inserted at at, or -len deleted from
+// there. Rather than the whole row being copied and lexed again, render and
+// hl up to their gap are moved along and only the tokens around the edit
+// are lexed, so typing into a long line costs no more than into a short one.
+static void rowChangedAt(erow *row, int at, int len) {
+    // A row that was never drawn is left to be highlighted when it is
+    if (!row->render) {
+        int y = editorRowIndex(row);
+        editorSyntaxInvalidate(y + 1);
+        editorDamageRows(y, y);
+        return;
+    }
+    if (row->hl_in < 0 || row->rsize != row->size - len) {
+        rowChanged(row);
+        return;
+    }
+    
+    int out = row->hl_open_comment;
+    rowReserveRender(row);
+    
+    // Keep the gap between one and four windows past the edit: typing on
+    // from there only moves it along every so often
+    int end = len > 0 ? at : at - len;
+    if (row->rgap < end + HL_EDIT_WINDOW || row->rgap > end + 4 * HL_EDIT_WINDOW)
+        rowMoveRenderGap(row, end + 2 * HL_EDIT_WINDOW < row->rsize ? end + 2 * HL_EDIT_WINDOW : row->rsize);
+    
+    if (len > 0) {
+        memmove(&row->render[at + len], &row->render[at], row->rgap - at);
+        memmove(&row->hl[at + len], &row->hl[at], row->rgap - at);
+        // The gap was moved to at, so the new bytes are in place in chars
+        memcpy(&row->render[at], &row->chars[at], len);
+    } else {
+        memmove(&row->render[at], &row->render[at - len], row->rgap - at + len);
+        memmove(&row->hl[at], &row->hl[at - len], row->rgap - at + len);
+    }
+    row->rgap += len;
+    row->rsize = row->size;
+    if (row->rgap == row->rsize) row->render[row->rsize] = '\0';
+    
+    editorSyntaxRowEdit(row, at, len);
+    editorSyntaxRowChanged(row, out);
+    
+    int y = editorRowIndex(row);
+    editorDamageRows(y, y);
+}
+
+// Mark the buffer modified. E.changes tells a save whether the buffer was
+// edited while it was being written.
+static void rowEdited() {
+    E.dirty = 1;
+    E.changes++;
+}
+
+// Make a row holding a copy of s; it is highlighted when it is first drawn
+static void rowInit(erow *row, const char *s, size_t len) {
+    row->size = len;
+    row->cap = len + 1;
+    row->gap = len;
+    row->chars = malloc(row->cap);
+    memcpy(row->chars, s, len);
+    E.rowbytes += row->cap;
+    
+    row->rsize = 0;
+    row->rgap = 0;
+    row->rcap = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->hl_in = -1;
+    row->hl_open_comment = 0;
+}
+
 void editorInsertRow(int at, char *s, size_t len) {
     if (at < 0 || at > E.numrows) return;
     
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+    editorUndoRecord(UNDO_INSERT, 1, at, 0, s, len);
+    editorJournalRecord(UNDO_INSERT, 1, at, 0, s, len);
+    erow row;
+    rowInit(&row, s, len);
+    editorRowTreeInsert(at, &row);
+    editorSyntaxInsertRow(at);
+    editorDamageRows(at, INT_MAX);
+    E.numrows++;
+    rowEdited();
+}
+
+// Insert the lines of s, separated by '\n', as rows from at on. However
+// many there are, the lexer state below them is only worked out again
+// once, lazily, rather than carried down after every row.
+int editorInsertRows(int at, const char *s, size_t len) {
+    if (at < 0 || at > E.numrows) return 0;
+    
+    editorUndoRecord(UNDO_INSERT, 1, at, 0, s, len);
+    editorJournalRecord(UNDO_INSERT, 1, at, 0, s, len);
+    const char *end = s + len;
+    int n = 0;
+    while (1) {
+        const char *nl = memchr(s, '\n', end - s);
+        erow row;
+        rowInit(&row, s, nl ? (size_t)(nl - s) : (size_t)(end - s));
+        editorRowTreeInsert(at + n++, &row);
+        if (!nl) break;
+        s = nl + 1;
+    }
     
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
+    E.numrows += n;
+    editorSyntaxInvalidate(at);
+    editorDamageRows(at, INT_MAX);
+    rowEdited();
+    return n;
+}
+
+// Add text that was appended to the file on disk, its lines separated by
+// '\n', at the end of the buffer. With join, the text up to the first '\n'
+// carries on the last row, a line the file had not finished yet. It is the
+// file's own text rather than an edit, so it goes neither into the history
+// nor into the journal, and the buffer is not marked modified. Only the new
+// rows are highlighted, when they are drawn.
+void editorAppendFileRows(const char *s, size_t len, int join) {
+    const char *end = s + len;
+    int at = E.numrows;
+    int n = 0;
     
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    E.row[at].hl = NULL;
-    editorUpdateRow(&E.row[at]);
+    if (join && E.numrows > 0) {
+        const char *nl = memchr(s, '\n', len);
+        size_t add = nl ? (size_t)(nl - s) : len;
+        erow *row = editorRowAt(E.numrows - 1);
+        
+        rowReserve(row, add);
+        rowMoveGap(row, row->size);
+        memcpy(&row->chars[row->gap], s, add);
+        row->gap += add;
+        row->size += add;
+        at--;
+        s = nl ? nl + 1 : end;
+    }
+    while (s < end) {
+        const char *nl = memchr(s, '\n', end - s);
+        erow row;
+        rowInit(&row, s, nl ? (size_t)(nl - s) : (size_t)(end - s));
+        editorRowTreeInsert(E.numrows + n++, &row);
+        if (!nl) break;
+        s = nl + 1;
+    }
     
-    E.numrows++;
-    E.dirty = 1;
+    E.numrows += n;
+    if (at < E.numrows) {
+        erow *row = editorRowAt(at);
+        if (row->render) editorUpdateRow(row);
+        editorSyntaxInvalidate(at);
+        editorDamageRows(at, INT_MAX);
+    }
+    E.changes++;
 }
 
 void editorAppendRow(char *s, size_t len) {
@@ -43,48 +276,157 @@ void editorAppendRow(char *s, size_t len) {
 }
 
 void editorFreeRow(erow *row) {
+    E.rowbytes -= row->cap + 2 * (size_t)row->rcap;
     free(row->render);
-    free(row->chars);
+    if (row->cap) free(row->chars);
     free(row->hl);
 }
 
 void editorDelRow(int at) {
     if (at < 0 || at >= E.numrows) return;
     
-    editorFreeRow(&E.row[at]);
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
+    erow *row = editorRowAt(at);
+    rowMoveGap(row, row->size);
+    editorUndoRecord(UNDO_DELETE, 1, at, 0, row->chars, row->size);
+    editorJournalRecord(UNDO_DELETE, 1, at, 0, NULL, 1);
+    
+    editorSyntaxDelRow(at);
+    editorFreeRow(row);
+    editorRowTreeRemove(at);
+    editorDamageRows(at, INT_MAX);
     E.numrows--;
-    E.dirty = 1;
+    rowEdited();
 }
 
-void editorRowInsertChar(erow *row, int at, int c) {
+// Delete n rows from at on, working out the lexer state below them again
+// once rather than after every row
+void editorDelRows(int at, int n) {
+    if (at < 0 || n <= 0 || at + n > E.numrows) return;
+    
+    // The undo history gets the rows joined by '\n'
+    if (editorUndoRecording()) {
+        size_t len = 0, pos = 0;
+        rowIter it;
+        erow *row;
+        
+        editorRowIterInit(&it, at, 0);
+        for (int i = 0; i < n && (row = editorRowIterNext(&it)) != NULL; i++)
+            len += row->size + 1;
+        
+        char *text = malloc(len);
+        editorRowIterInit(&it, at, 0);
+        for (int i = 0; i < n && (row = editorRowIterNext(&it)) != NULL; i++) {
+            int tail = row->size - row->gap;
+            memcpy(&text[pos], row->chars, row->gap);
+            memcpy(&text[pos + row->gap], &row->chars[row->cap - tail], tail);
+            pos += row->size;
+            text[pos++] = '\n';
+        }
+        editorUndoRecord(UNDO_DELETE, 1, at, 0, text, len - 1);
+        free(text);
+    }
+    editorJournalRecord(UNDO_DELETE, 1, at, 0, NULL, n);
+    
+    for (int i = 0; i < n; i++) {
+        editorFreeRow(editorRowAt(at));
+        editorRowTreeRemove(at);
+    }
+    
+    E.numrows -= n;
+    editorSyntaxInvalidate(at);
+    editorDamageRows(at, INT_MAX);
+    rowEdited();
+}
+
+void editorRowInsertString(erow *row, int at, const char *s, size_t len) {
     if (at < 0 || at > row->size) at = row->size;
     
-    row->chars = realloc(row->chars, row->size + 2);
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    row->size++;
-    row->chars[at] = c;
+    int y = editorRowIndex(row);
+    editorUndoRecord(UNDO_INSERT, 0, y, at, s, len);
+    editorJournalRecord(UNDO_INSERT, 0, y, at, s, len);
+    rowReserve(row, len);
+    rowMoveGap(row, at);
+    memcpy(&row->chars[row->gap], s, len);
+    row->gap += len;
+    row->size += len;
     
-    editorUpdateRow(row);
-    E.dirty = 1;
+    rowEdited();
+    rowChangedAt(row, at, len);
+}
+
+void editorRowInsertChar(erow *row, int at, int c) {
+    char ch = c;
+    editorRowInsertString(row, at, &ch, 1);
 }
 
 void editorRowAppendString(erow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
+    editorRowInsertString(row, row->size, s, len);
+}
+
+// Delete len bytes from at on. They follow the gap once it is moved to at,
+// so deleting them only shortens the text after the gap.
+void editorRowDelString(erow *row, int at, int len) {
+    if (at < 0 || at >= row->size || len <= 0) return;
+    if (len > row->size - at) len = row->size - at;
     
-    editorUpdateRow(row);
-    E.dirty = 1;
+    rowOwn(row);
+    rowMoveGap(row, at);
+    int y = editorRowIndex(row);
+    editorUndoRecord(UNDO_DELETE, 0, y, at, &row->chars[row->cap - (row->size - at)], len);
+    editorJournalRecord(UNDO_DELETE, 0, y, at, NULL, len);
+    row->size -= len;
+    
+    rowEdited();
+    rowChangedAt(row, at, -len);
 }
 
 void editorRowDelChar(erow *row, int at) {
-    if (at < 0 || at >= row->size) return;
+    editorRowDelString(row, at, 1);
+}
+
+// Give a row the text s[0, len) in place of its own, as :s does once it
+// has worked out all the changes to the row: the text is allocated and
+// the row highlighted once, however much of it changed. The history only
+// gets the part between the text both have in common at either end.
+void editorRowSetText(erow *row, const char *s, size_t len) {
+    int y = editorRowIndex(row);
+    size_t pre = 0, post = 0;
     
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
+    if (row->cap) rowMoveGap(row, row->size);
+    while (pre < len && pre < (size_t)row->size && s[pre] == row->chars[pre]) pre++;
+    while (post < len - pre && post < row->size - pre && s[len - post - 1] == row->chars[row->size - post - 1])
+        post++;
     
-    editorUpdateRow(row);
-    E.dirty = 1;
-}
\ No newline at end of file
+    if (row->size - pre - post > 0) {
+        editorUndoRecord(UNDO_DELETE, 0, y, pre, &row->chars[pre], row->size - pre - post);
+        editorJournalRecord(UNDO_DELETE, 0, y, pre, NULL, row->size - pre - post);
+    }
+    if (len - pre - post > 0) {
+        editorUndoRecord(UNDO_INSERT, 0, y, pre, &s[pre], len - pre - post);
+        editorJournalRecord(UNDO_INSERT, 0, y, pre, &s[pre], len - pre - post);
+    }
+    
+    if ((size_t)row->cap < len + 1) {
+        if (row->cap) free(row->chars);
+        row->chars = malloc(len + 1);
+        E.rowbytes += len + 1 - row->cap;
+        row->cap = len + 1;
+    }
+    memcpy(row->chars, s, len);
+    row->size = len;
+    row->gap = len;
+    
+    // A row that was never drawn is left to be highlighted when it is
+    if (row->render) {
+        rowChanged(row);
+    } else {
+        editorSyntaxInvalidate(y + 1);
+        editorDamageRows(y, y);
+    }
+    rowEdited();
+}
+
+void editorRowTruncate(erow *row, int len) {
+    if (len < 0 || len >= row->size) return;
+    editorRowDelString(row, len, row->size - len);
+}
@@ -0,0 +1,455 @@
+#include "axcode.h"
+
+// Rows are kept in a counted B+tree: leaves hold up to ROWTREE_ORDER rows,
+// internal nodes hold up to ROWTREE_ORDER children and every node knows how
+// many rows live below it. Finding, inserting or deleting row N costs
+// O(log n) plus a memmove of at most one node, wherever N is in the file.
+// Nodes point at their parent and rows at their leaf, so the index of a row
+// can be found from the row itself.
+#define ROWTREE_ORDER 64
+#define ROWTREE_MIN (ROWTREE_ORDER / 4)
+
+struct rowNode {
+    int leaf;               // Leaf nodes hold rows, internal nodes hold children
+    int n;                  // Number of rows or children in this node
+    int count;              // Total number of rows in this subtree
+    int first;              // First file line of a leaf that is not loaded yet
+    int inarena;            // Allocated from E.arena and released with it
+    int hl_state;           // Lexer state at the first row of a leaf, -1 if unknown
+    struct rowNode *parent; // Parent node, NULL for the root
+    struct rowNode **kids;  // Children (internal nodes only)
+    erow *rows;             // Rows (loaded leaf nodes only)
+};
+
+static size_t nodeSize(int leaf) {
+    return sizeof(struct rowNode) + (leaf ? sizeof(erow) * ROWTREE_ORDER
+                                          : sizeof(struct rowNode *) * ROWTREE_ORDER);
+}
+
+static struct rowNode *nodeInit(struct rowNode *node, int leaf, int inarena) {
+    node->leaf = leaf;
+    node->n = 0;
+    node->count = 0;
+    node->first = 0;
+    node->inarena = inarena;
+    node->hl_state = -1;
+    node->parent = NULL;
+    node->kids = leaf ? NULL : (struct rowNode **)(node + 1);
+    node->rows = leaf ? (erow *)(node + 1) : NULL;
+    return node;
+}
+
+// Nodes made after the file was loaded are allocated one by one, and
+// counted in E.rowbytes
+static struct rowNode *nodeNew(int leaf) {
+    E.rowbytes += nodeSize(leaf);
+    return nodeInit(malloc(nodeSize(leaf)), leaf, 0);
+}
+
+static void nodeRelease(struct rowNode *node) {
+    if (node->inarena) return;
+    E.rowbytes -= nodeSize(node->leaf);
+    free(node);
+}
+
+// Point the rows or children in [from, to) back at the node holding them
+static void nodeAdopt(struct rowNode *node, int from, int to) {
+    for (int i = from; i < to; i++) {
+        if (node->leaf)
+            node->rows[i].leaf = node;
+        else
+            node->kids[i]->parent = node;
+    }
+}
+
+// Replace an unloaded leaf by a loaded one whose rows point into E.text
+static struct rowNode *nodeLoad(struct rowNode *node) {
+    if (!node->leaf || node->rows) return node;
+    
+    struct rowNode *loaded = nodeNew(1);
+    for (int i = 0; i < node->n; i++)
+        editorMapRow(&loaded->rows[i], node->first + i);
+    loaded->n = node->n;
+    loaded->count = node->n;
+    loaded->hl_state = node->hl_state;
+    loaded->parent = node->parent;
+    nodeAdopt(loaded, 0, loaded->n);
+    nodeRelease(node);
+    return loaded;
+}
+
+static struct rowNode *nodeKid(struct rowNode *node, int i) {
+    node->kids[i] = nodeLoad(node->kids[i]);
+    return node->kids[i];
+}
+
+static void nodeRecount(struct rowNode *node) {
+    if (node->leaf) {
+        node->count = node->n;
+        return;
+    }
+    node->count = 0;
+    for (int i = 0; i < node->n; i++)
+        node->count += node->kids[i]->count;
+}
+
+// Find the child of an internal node holding row *at and make *at relative to it
+static int nodeChildFor(struct rowNode *node, int *at) {
+    int i = 0;
+    while (i < node->n - 1 && *at >= node->kids[i]->count) {
+        *at -= node->kids[i]->count;
+        i++;
+    }
+    return i;
+}
+
+// Move the upper half of a full node into a new right sibling
+static struct rowNode *nodeSplit(struct rowNode *node) {
+    struct rowNode *right = nodeNew(node->leaf);
+    int half = node->n / 2;
+    
+    right->n = node->n - half;
+    if (node->leaf)
+        memcpy(right->rows, &node->rows[half], sizeof(erow) * right->n);
+    else
+        memcpy(right->kids, &node->kids[half], sizeof(struct rowNode *) * right->n);
+    node->n = half;
+    nodeAdopt(right, 0, right->n);
+    
+    nodeRecount(node);
+    nodeRecount(right);
+    return right;
+}
+
+static void leafInsert(struct rowNode *leaf, int at, erow *row) {
+    memmove(&leaf->rows[at + 1], &leaf->rows[at], sizeof(erow) * (leaf->n - at));
+    leaf->rows[at] = *row;
+    leaf->rows[at].leaf = leaf;
+    leaf->n++;
+    leaf->count++;
+}
+
+// Add a child at position pos; returns a new right sibling if the node split
+static struct rowNode *nodeAddChild(struct rowNode *node, int pos, struct rowNode *kid) {
+    struct rowNode *right = NULL;
+    struct rowNode *target = node;
+    
+    if (node->n == ROWTREE_ORDER) {
+        right = nodeSplit(node);
+        if (pos > node->n) {
+            pos -= node->n;
+            target = right;
+        }
+    }
+    
+    memmove(&target->kids[pos + 1], &target->kids[pos],
+            sizeof(struct rowNode *) * (target->n - pos));
+    target->kids[pos] = kid;
+    kid->parent = target;
+    target->n++;
+    
+    nodeRecount(node);
+    if (right) nodeRecount(right);
+    return right;
+}
+
+// Insert a row at index at within the subtree; returns a new right sibling
+// if the node had to split to make room
+static struct rowNode *nodeInsert(struct rowNode *node, int at, erow *row) {
+    if (node->leaf) {
+        struct rowNode *right = NULL;
+        if (node->n == ROWTREE_ORDER) {
+            right = nodeSplit(node);
+            if (at > node->n) {
+                leafInsert(right, at - node->n, row);
+                return right;
+            }
+        }
+        leafInsert(node, at, row);
+        return right;
+    }
+    
+    int i = 0;
+    while (i < node->n - 1 && at > node->kids[i]->count) {
+        at -= node->kids[i]->count;
+        i++;
+    }
+    
+    struct rowNode *split = nodeInsert(nodeKid(node, i), at, row);
+    node->count++;
+    if (!split) return NULL;
+    return nodeAddChild(node, i + 1, split);
+}
+
+// Fix up child i after it dropped below ROWTREE_MIN entries by merging it
+// with a neighbour or, if both together are too big, sharing entries evenly.
+// The right node then starts at a different row, so its checkpoint is lost.
+static void nodeRebalance(struct rowNode *node, int i) {
+    if (node->n < 2) return;
+    
+    int l = (i > 0) ? i - 1 : i;
+    struct rowNode *left = nodeKid(node, l);
+    struct rowNode *right = nodeKid(node, l + 1);
+    size_t size = left->leaf ? sizeof(erow) : sizeof(struct rowNode *);
+    char *lbuf = left->leaf ? (char *)left->rows : (char *)left->kids;
+    char *rbuf = right->leaf ? (char *)right->rows : (char *)right->kids;
+    
+    if (left->n + right->n <= ROWTREE_ORDER) {
+        memcpy(lbuf + size * left->n, rbuf, size * right->n);
+        nodeAdopt(left, left->n, left->n + right->n);
+        left->n += right->n;
+        nodeRecount(left);
+        nodeRelease(right);
+        memmove(&node->kids[l + 1], &node->kids[l + 2],
+                sizeof(struct rowNode *) * (node->n - l - 2));
+        node->n--;
+        return;
+    }
+    
+    int total = left->n + right->n;
+    int want = total / 2;
+    if (left->n < want) {
+        int move = want - left->n;
+        memcpy(lbuf + size * left->n, rbuf, size * move);
+        memmove(rbuf, rbuf + size * move, size * (right->n - move));
+        nodeAdopt(left, left->n, left->n + move);
+        left->n += move;
+        right->n -= move;
+    } else if (left->n > want) {
+        int move = left->n - want;
+        memmove(rbuf + size * move, rbuf, size * right->n);
+        memcpy(rbuf, lbuf + size * want, size * move);
+        nodeAdopt(right, 0, move);
+        left->n -= move;
+        right->n += move;
+    }
+    right->hl_state = -1;
+    nodeRecount(left);
+    nodeRecount(right);
+}
+
+// Remove row at index at within the subtree (the row itself is not freed)
+static void nodeRemove(struct rowNode *node, int at) {
+    node->count--;
+    if (node->leaf) {
+        memmove(&node->rows[at], &node->rows[at + 1], sizeof(erow) * (node->n - at - 1));
+        node->n--;
+        return;
+    }
+    
+    int i = nodeChildFor(node, &at);
+    nodeRemove(nodeKid(node, i), at);
+    if (node->kids[i]->n < ROWTREE_MIN)
+        nodeRebalance(node, i);
+}
+
+static void nodeFree(struct rowNode *node) {
+    if (node->leaf && node->rows) {
+        for (int i = 0; i < node->n; i++)
+            editorFreeRow(&node->rows[i]);
+    } else if (!node->leaf) {
+        for (int i = 0; i < node->n; i++)
+            nodeFree(node->kids[i]);
+    }
+    nodeRelease(node);
+}
+
+erow *editorRowAt(int at) {
+    if (!E.row || at < 0 || at >= E.row->count) return NULL;
+    
+    struct rowNode *node = E.row = nodeLoad(E.row);
+    while (!node->leaf)
+        node = nodeKid(node, nodeChildFor(node, &at));
+    return &node->rows[at];
+}
+
+void editorRowTreeInsert(int at, erow *row) {
+    if (!E.row) E.row = nodeNew(1);
+    E.row = nodeLoad(E.row);
+    
+    struct rowNode *split = nodeInsert(E.row, at, row);
+    if (split) {
+        struct rowNode *root = nodeNew(0);
+        root->kids[0] = E.row;
+        root->kids[1] = split;
+        root->n = 2;
+        nodeAdopt(root, 0, 2);
+        nodeRecount(root);
+        E.row = root;
+    }
+}
+
+void editorRowTreeRemove(int at) {
+    if (!E.row || at < 0 || at >= E.row->count) return;
+    
+    E.row = nodeLoad(E.row);
+    nodeRemove(E.row, at);
+    while (!E.row->leaf && E.row->n == 1) {
+        struct rowNode *old = E.row;
+        E.row = old->kids[0];
+        E.row->parent = NULL;
+        nodeRelease(old);
+    }
+}
+
+int editorRowIndex(erow *row) {
+    struct rowNode *node = row->leaf;
+    if (!node) return -1;
+    
+    int at = row - node->rows;
+    while (node->parent) {
+        struct rowNode *parent = node->parent;
+        for (int i = 0; parent->kids[i] != node; i++)
+            at += parent->kids[i]->count;
+        node = parent;
+    }
+    return at;
+}
+
+// Lexer state saved at the first row of the leaf holding row at, or -1 if
+// it is not known. *start is set to that first row. Checkpoints belong to
+// leaves, so there is one every ROWTREE_MIN to ROWTREE_ORDER rows and they
+// stay with their rows as lines are inserted and deleted above them.
+int editorRowTreeCheckpoint(int at, int *start) {
+    struct rowNode *node = E.row;
+    int rel = at;
+    
+    *start = 0;
+    if (!node || at < 0 || at >= node->count) return -1;
+    while (!node->leaf)
+        node = node->kids[nodeChildFor(node, &rel)];
+    *start = at - rel;
+    return *start == 0 ? 0 : node->hl_state;
+}
+
+void editorRowTreeClear() {
+    if (E.row) nodeFree(E.row);
+    E.row = NULL;
+    E.numrows = 0;
+}
+
+// Group nodes into parents of at most ROWTREE_ORDER children, spreading
+// them evenly so that every parent is at least half full
+static int nodeGroup(struct rowNode **nodes, int n) {
+    int parents = (n + ROWTREE_ORDER - 1) / ROWTREE_ORDER;
+    int next = 0;
+    
+    for (int p = 0; p < parents; p++) {
+        int take = n / parents + (p < n % parents);
+        struct rowNode *parent = nodeInit(arenaAlloc(&E.arena, nodeSize(0)), 0, 1);
+        memcpy(parent->kids, &nodes[next], sizeof(struct rowNode *) * take);
+        parent->n = take;
+        nodeAdopt(parent, 0, take);
+        nodeRecount(parent);
+        nodes[p] = parent;
+        next += take;
+    }
+    return parents;
+}
+
+// Build the tree for the nlines lines of E.text out of unloaded leaves,
+// which are only headers: their rows are created by nodeLoad() when first
+// touched. All nodes come from E.arena, so this costs a handful of slab
+// allocations however many lines there are.
+void editorRowTreeLoadLines(int nlines) {
+    editorRowTreeClear();
+    if (nlines == 0) return;
+    
+    int n = (nlines + ROWTREE_ORDER - 1) / ROWTREE_ORDER;
+    struct rowNode **nodes = malloc(sizeof(struct rowNode *) * n);
+    struct rowNode *leaves = arenaAlloc(&E.arena, sizeof(struct rowNode) * n);
+    int first = 0;
+    for (int i = 0; i < n; i++) {
+        int take = nlines / n + (i < nlines % n);
+        nodes[i] = nodeInit(&leaves[i], 1, 1);
+        nodes[i]->rows = NULL;
+        nodes[i]->n = nodes[i]->count = take;
+        nodes[i]->first = first;
+        first += take;
+    }
+    
+    while (n > 1)
+        n = nodeGroup(nodes, n);
+    E.row = nodes[0];
+    E.numrows = nlines;
+    free(nodes);
+}
+
+void editorRowIterInit(rowIter *it, int at, int loaded_only) {
+    it->depth = 0;
+    it->loaded_only = loaded_only;
+    if (!E.row || at < 0 || at >= E.row->count) return;
+    
+    struct rowNode *node = E.row;
+    while (!node->leaf) {
+        int i = nodeChildFor(node, &at);
+        it->path[it->depth] = node;
+        it->idx[it->depth++] = i;
+        node = node->kids[i];
+    }
+    it->path[it->depth] = node;
+    it->idx[it->depth++] = at;
+}
+
+erow *editorRowIterNext(rowIter *it) {
+    while (it->depth > 0) {
+        int d = it->depth - 1;
+        struct rowNode *node = it->path[d];
+        
+        if (it->idx[d] >= node->n || (node->leaf && !node->rows && it->loaded_only)) {
+            // Done with this node, continue with the next sibling
+            it->depth--;
+            if (it->depth > 0) it->idx[it->depth - 1]++;
+            continue;
+        }
+        if (!node->leaf) {
+            it->path[it->depth] = node->kids[it->idx[d]];
+            it->idx[it->depth++] = 0;
+            continue;
+        }
+        
+        int i = it->idx[d]++;
+        if (node->rows) return &node->rows[i];
+        editorMapRow(&it->tmp, node->first + i);
+        return &it->tmp;
+    }
+    return NULL;
+}
+
+// Step over up to max rows of a leaf that is not loaded, which are lines
+// of the loaded text following each other. Returns how many rows were
+// passed and sets *line to the line of the first; returns 0 if the next
+// row is loaded.
+int editorRowIterLines(rowIter *it, int max, size_t *line) {
+    while (it->depth > 0) {
+        int d = it->depth - 1;
+        struct rowNode *node = it->path[d];
+        
+        if (it->idx[d] >= node->n) {
+            it->depth--;
+            if (it->depth > 0) it->idx[it->depth - 1]++;
+            continue;
+        }
+        if (!node->leaf) {
+            it->path[it->depth] = node->kids[it->idx[d]];
+            it->idx[it->depth++] = 0;
+            continue;
+        }
+        if (node->rows || max <= 0) return 0;
+        
+        int n = node->n - it->idx[d] < max ? node->n - it->idx[d] : max;
+        *line = node->first + it->idx[d];
+        it->idx[d] += n;
+        return n;
+    }
+    return 0;
+}
+
+// Save state as the checkpoint of the leaf whose first row was just returned
+void editorRowIterCheckpoint(rowIter *it, int state) {
+    if (it->depth == 0) return;
+    
+    struct rowNode *node = it->path[it->depth - 1];
+    if (node->leaf && it->idx[it->depth - 1] == 1)
+        node->hl_state = state;
+}
@@ -0,0 +1,172 @@
+#include "axcode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+// Line starts are stored as 32-bit offsets relative to the start of their
+// block of LINEINDEX_BLOCK lines, which keeps the index at about four bytes
+// per line however big the file is. Capacity is a multiple of the block
+// size, so growing only ever happens at the first line of a block. A line
+// starting 4 GB or more past its block, which only lines of gigabytes
+// lead to, is marked with LINEINDEX_WIDE and its start kept in full in
+// idx->wide instead.
+static void indexGrow(lineIndex *idx, size_t pos) {
+    if (idx->nlines == idx->cap) {
+        idx->cap = idx->cap ? idx->cap * 2 : LINEINDEX_BLOCK;
+        idx->rel = realloc(idx->rel, sizeof(uint32_t) * idx->cap);
+        idx->base = realloc(idx->base, sizeof(size_t) * (idx->cap / LINEINDEX_BLOCK + 1));
+    }
+    if (idx->nlines % LINEINDEX_BLOCK == 0)
+        idx->base[idx->nlines / LINEINDEX_BLOCK] = pos;
+}
+
+static void indexPushWide(lineIndex *idx, size_t pos) {
+    if (idx->nwide == idx->widecap) {
+        idx->widecap = idx->widecap ? idx->widecap * 2 : 16;
+        idx->wide = realloc(idx->wide, sizeof(lineWide) * idx->widecap);
+    }
+    idx->wide[idx->nwide].line = idx->nlines;
+    idx->wide[idx->nwide++].start = pos;
+    idx->rel[idx->nlines++] = LINEINDEX_WIDE;
+}
+
+static inline void indexPush(lineIndex *idx, size_t pos) {
+    if (idx->nlines % LINEINDEX_BLOCK == 0) indexGrow(idx, pos);
+    
+    size_t rel = pos - idx->base[idx->nlines / LINEINDEX_BLOCK];
+    if (rel >= LINEINDEX_WIDE) {
+        indexPushWide(idx, pos);
+        return;
+    }
+    idx->rel[idx->nlines++] = rel;
+}
+
+// Record the start of every line following a newline in buf[pos, len)
+static void scanScalar(lineIndex *idx, const char *buf, size_t pos, size_t len) {
+    while (pos < len) {
+        const char *nl = memchr(&buf[pos], '\n', len - pos);
+        if (!nl) break;
+        pos = nl - buf + 1;
+        if (pos < len) indexPush(idx, pos);
+    }
+}
+
+#ifdef SCAN_X86
+// Turn a bitmask of newline positions starting at buf[i] into line starts
+static void scanMask(lineIndex *idx, size_t i, uint64_t mask, size_t len) {
+    while (mask) {
+        size_t pos = i + __builtin_ctzll(mask) + 1;
+        if (pos < len) indexPush(idx, pos);
+        mask &= mask - 1;
+    }
+}
+
+__attribute__((target("sse2")))
+static void scanSSE2(lineIndex *idx, const char *buf, size_t len) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+    
+    for (; i + 64 <= len; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)&buf[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&buf[i + 16]);
+        __m128i c = _mm_loadu_si128((const __m128i *)&buf[i + 32]);
+        __m128i d = _mm_loadu_si128((const __m128i *)&buf[i + 48]);
+        uint64_t mask = (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(a, nl)) |
+                        (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(b, nl)) << 16 |
+                        (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(c, nl)) << 32 |
+                        (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(d, nl)) << 48;
+        if (mask) scanMask(idx, i, mask, len);
+    }
+    scanScalar(idx, buf, i, len);
+}
+
+__attribute__((target("avx2")))
+static void scanAVX2(lineIndex *idx, const char *buf, size_t len) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    
+    for (; i + 64 <= len; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)&buf[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i *)&buf[i + 32]);
+        uint64_t mask = (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl)) |
+                        (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, nl)) << 32;
+        if (mask) scanMask(idx, i, mask, len);
+    }
+    scanScalar(idx, buf, i, len);
+}
+#endif
+
+void editorScanLines(lineIndex *idx, const char *buf, size_t len, int simd) {
+    memset(idx, 0, sizeof(*idx));
+    idx->end = len;
+    if (len == 0) return;
+    indexPush(idx, 0);
+    
+#ifdef SCAN_X86
+    if (simd && __builtin_cpu_supports("avx2")) {
+        scanAVX2(idx, buf, len);
+        return;
+    }
+    if (simd && __builtin_cpu_supports("sse2")) {
+        scanSSE2(idx, buf, len);
+        return;
+    }
+#else
+    (void)simd;
+#endif
+    scanScalar(idx, buf, 0, len);
+}
+
+// Start of a line marked LINEINDEX_WIDE, found among the few of them
+static size_t indexWideStart(lineIndex *idx, size_t line) {
+    size_t lo = 0, hi = idx->nwide;
+    
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->wide[mid].line <= line)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return idx->wide[lo].start;
+}
+
+size_t editorLineStart(lineIndex *idx, size_t line) {
+    if (line >= idx->nlines) return idx->end;
+    if (idx->rel[line] == LINEINDEX_WIDE) return indexWideStart(idx, line);
+    return idx->base[line / LINEINDEX_BLOCK] + idx->rel[line];
+}
+
+// Line holding byte off of the text
+size_t editorLineOf(lineIndex *idx, size_t off) {
+    size_t lo = 0, hi = idx->nlines;
+    
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (editorLineStart(idx, mid) <= off)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Start of a line and its length without the trailing newline characters
+size_t editorLineSpan(lineIndex *idx, const char *buf, size_t line, size_t *len) {
+    size_t start = editorLineStart(idx, line);
+    size_t end = editorLineStart(idx, line + 1);
+    
+    while (end > start && (buf[end - 1] == '\n' || buf[end - 1] == '\r'))
+        end--;
+    *len = end - start;
+    return start;
+}
+
+void editorLineIndexFree(lineIndex *idx) {
+    free(idx->rel);
+    free(idx->base);
+    free(idx->wide);
+    memset(idx, 0, sizeof(*idx));
+}
@@ -0,0 +1,810 @@
+#include "axcode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_X86 1
+#endif
+
+// Bytes searched between checks for keys typed in the meantime
+#define SEARCH_SLICE (4 * 1024 * 1024)
+
+// Searching looks at the rows still pointing into the loaded file as the
+// one block of text they are part of, however many rows that is, and only
+// at edited rows one by one. Blocks are scanned for the first and last
+// byte of the pattern at once and only the places where both turn up are
+// compared in full.
+struct searchScan {
+    const char *pat;
+    size_t len;
+    int last;           // Find the last match rather than the first
+    int interruptible;  // Give up as soon as a key is typed
+    int interrupted;
+    int found, row, col;
+    size_t scanned;     // Bytes searched since keys were last checked for
+    const char *run, *runend; // Loaded text of the rows gathered so far
+    int runrow;         // Row the run starts at
+};
+
+// Regular expressions, patterns starting with \v, are searched for on a
+// pool of threads. The rows are cut into chunks of about SEARCH_CHUNK bytes
+// that the threads scan for lines which may hold a match, starting with the
+// chunk of the cursor. The main thread goes through the chunks in file
+// order, scanning any no thread has taken yet itself, so the next match is
+// known as soon as the chunks up to it are done while the rest are still
+// scanned for the n and N after it. Threads only read the loaded text,
+// which does not change while the file is open, and copies of edited rows;
+// what they found holds until the rows are edited again.
+#define SEARCH_CHUNK (1024 * 1024)
+#define SEARCH_MAX_THREADS 64
+
+enum searchChunkState { CHUNK_QUEUED, CHUNK_TAKEN, CHUNK_DONE };
+
+struct searchChunk {
+    const char *text;   // The rows, joined by line breaks
+    size_t len;
+    char *copy;         // Edited rows copied for text, if that is what it is
+    int row;            // First row
+    int state;          // Guarded by searchLock
+    int *lines;         // Rows that may hold a match, counted from row
+    int nlines;
+};
+
+struct searchJob {
+    unsigned id;
+    const regex *re;
+    unsigned long changes; // E.changes when the rows were taken
+    struct searchChunk *chunks;
+    int n, cap;
+    int *order;         // Chunks in the order threads take them
+    int next;           // Next in order to hand out
+    int running;        // Threads scanning a chunk of the job
+    int cancel;
+    struct editorConfig *owner; // Buffer the rows belong to
+};
+
+static pthread_mutex_t searchLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t searchWork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t searchDone = PTHREAD_COND_INITIALIZER;
+static struct searchJob *searchJob; // Only replaced by the main thread
+static unsigned searchJobs;     // Jobs started so far
+static int searchThreads;
+static regex *searchRegex;      // E.search compiled, if it starts with \v
+static const char *searchRegexError; // Why it did not compile
+static regexDFA *searchDFA;     // The main thread's, for job searchDFAJob
+static unsigned searchDFAJob;
+
+static int searchOriginY, searchOriginX; // Cursor when / was typed
+static char *searchPrev;        // Pattern before the one being typed
+static int searchPrevLen;
+static int searchComplete;      // The pattern being typed was searched in full
+
+static const char *searchScalar(const char *s, size_t n, const char *p, size_t m) {
+    const char *end = s + n - m + 1;
+    
+    while (s < end && (s = memchr(s, p[0], end - s)) != NULL) {
+        if (memcmp(s, p, m) == 0) return s;
+        s++;
+    }
+    return NULL;
+}
+
+#ifdef SEARCH_X86
+__attribute__((target("sse2")))
+static const char *searchSSE2(const char *s, size_t n, const char *p, size_t m) {
+    const __m128i first = _mm_set1_epi8(p[0]);
+    const __m128i last = _mm_set1_epi8(p[m - 1]);
+    size_t i = 0;
+    
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)&s[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&s[i + m - 1]);
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(&s[at], p, m) == 0) return &s[at];
+            mask &= mask - 1;
+        }
+    }
+    return i + m <= n ? searchScalar(&s[i], n - i, p, m) : NULL;
+}
+
+__attribute__((target("avx2")))
+static const char *searchAVX2(const char *s, size_t n, const char *p, size_t m) {
+    const __m256i first = _mm256_set1_epi8(p[0]);
+    const __m256i last = _mm256_set1_epi8(p[m - 1]);
+    size_t i = 0;
+    
+    // Two vectors at a time, so a block without candidates costs one test
+    for (; i + m - 1 + 64 <= n; i += 64) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i *)&s[i]);
+        __m256i a1 = _mm256_loadu_si256((const __m256i *)&s[i + 32]);
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)&s[i + m - 1]);
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)&s[i + m - 1 + 32]);
+        __m256i c0 = _mm256_and_si256(_mm256_cmpeq_epi8(a0, first), _mm256_cmpeq_epi8(b0, last));
+        __m256i c1 = _mm256_and_si256(_mm256_cmpeq_epi8(a1, first), _mm256_cmpeq_epi8(b1, last));
+        if (_mm256_testz_si256(_mm256_or_si256(c0, c1), _mm256_or_si256(c0, c1))) continue;
+        
+        uint64_t mask = (uint64_t)(unsigned)_mm256_movemask_epi8(c0) |
+                        (uint64_t)(unsigned)_mm256_movemask_epi8(c1) << 32;
+        while (mask) {
+            size_t at = i + __builtin_ctzll(mask);
+            if (memcmp(&s[at], p, m) == 0) return &s[at];
+            mask &= mask - 1;
+        }
+    }
+    return i + m <= n ? searchScalar(&s[i], n - i, p, m) : NULL;
+}
+#endif
+
+// First occurrence of p[0..m) in s[0..n), or NULL
+const char *editorSearchMem(const char *s, size_t n, const char *p, size_t m) {
+    if (m == 0 || n < m) return NULL;
+    
+#ifdef SEARCH_X86
+    if (__builtin_cpu_supports("avx2"))
+        return searchAVX2(s, n, p, m);
+    if (__builtin_cpu_supports("sse2"))
+        return searchSSE2(s, n, p, m);
+#endif
+    return searchScalar(s, n, p, m);
+}
+
+// Whether a row starting at next is the line right after the one ending at
+// end, that is whether only its line break lies between them
+static int searchFollows(const char *end, const char *next) {
+    if (next <= end || next[-1] != '\n') return 0;
+    while (end < next - 1 && *end == '\r') end++;
+    return end == next - 1;
+}
+
+// Whether a key was typed, which is put back to be read as usual
+static int searchKeyTyped(struct searchScan *s) {
+    s->scanned = 0;
+    
+    if (!E.keytyped || !E.keytyped()) return 0;
+    s->interrupted = 1;
+    return 1;
+}
+
+// Check for typed keys every SEARCH_SLICE bytes
+static int searchInterrupted(struct searchScan *s) {
+    if (!s->interruptible || s->scanned < SEARCH_SLICE) return 0;
+    return searchKeyTyped(s);
+}
+
+// Text of a row without copying rows that point into the loaded file
+static const char *searchChars(erow *row) {
+    return row->cap ? editorRowChars(row) : row->chars;
+}
+
+// Take a match; returns 1 if the search is over
+static int searchHit(struct searchScan *s, int row, int col) {
+    s->found = 1;
+    s->row = row;
+    s->col = col;
+    return !s->last;
+}
+
+// Search the text of row y for matches starting in [from, to)
+static int searchRow(struct searchScan *s, erow *row, int y, int from, int to) {
+    if (to > row->size) to = row->size;
+    if (from >= to) return 0;
+    
+    const char *chars = searchChars(row);
+    size_t end = (size_t)to + s->len - 1 < (size_t)row->size ? (size_t)to + s->len - 1 : (size_t)row->size;
+    const char *p = &chars[from];
+    
+    s->scanned += end - from;
+    while ((p = editorSearchMem(p, &chars[end] - p, s->pat, s->len)) != NULL) {
+        if (searchHit(s, y, p - chars)) return 1;
+        p++;
+    }
+    return searchInterrupted(s);
+}
+
+// Search rows following each other in the loaded text, text[0, len), the
+// first of which is row y. Long runs are searched in slices. Only the match
+// taken is placed in its row, with a lookup in the line index.
+static int searchRun(struct searchScan *s, const char *text, size_t len, int y) {
+    const char *hit = NULL;
+    
+    for (size_t pos = 0; pos < len && !(hit && !s->last); pos += SEARCH_SLICE) {
+        size_t end = pos + SEARCH_SLICE + s->len - 1 < len ? pos + SEARCH_SLICE + s->len - 1 : len;
+        const char *p = &text[pos];
+        
+        while ((p = editorSearchMem(p, &text[end] - p, s->pat, s->len)) != NULL && p < &text[pos + SEARCH_SLICE]) {
+            hit = p++;
+            if (!s->last) break;
+        }
+        s->scanned += end - pos;
+        if (searchInterrupted(s)) return 1;
+    }
+    if (!hit) return 0;
+    
+    size_t line = editorLineOf(&E.lines, text - E.text);
+    size_t at = editorLineOf(&E.lines, hit - E.text);
+    return searchHit(s, y + (at - line), hit - E.text - editorLineStart(&E.lines, at));
+}
+
+// Search the run of loaded text gathered so far
+static int searchFlush(struct searchScan *s) {
+    const char *run = s->run;
+    
+    s->run = NULL;
+    return run && searchRun(s, run, s->runend - run, s->runrow);
+}
+
+// Add rows y.. whose text is text[0, len) to the run being gathered; a
+// run they do not carry on is searched first
+static int searchGather(struct searchScan *s, const char *text, size_t len, int y) {
+    if (s->run && searchFollows(s->runend, text)) {
+        s->runend = text + len;
+        
+        // Search as it goes rather than gathering the whole file first
+        return s->runend - s->run >= SEARCH_SLICE ? searchFlush(s) : 0;
+    }
+    if (searchFlush(s)) return 1;
+    s->run = text;
+    s->runend = text + len;
+    s->runrow = y;
+    return 0;
+}
+
+// Search for matches starting between (from, fromcol) and (to, tocol)
+static void searchRange(struct searchScan *s, int from, int fromcol, int to, int tocol) {
+    rowIter it;
+    erow *row;
+    
+    s->run = NULL;
+    editorRowIterInit(&it, from, 0);
+    for (int y = from; y <= to; ) {
+        // Leaves that are not loaded are taken whole, without making rows
+        size_t line, len;
+        int n = y > from ? editorRowIterLines(&it, to - y, &line) : 0;
+        if (n > 0) {
+            size_t start = editorLineStart(&E.lines, line);
+            size_t tail = editorLineSpan(&E.lines, E.text, line + n - 1, &len);
+            if (searchGather(s, &E.text[start], tail + len - start, y)) return;
+            y += n;
+            continue;
+        }
+        
+        if ((row = editorRowIterNext(&it)) == NULL) break;
+        int first = y == from ? fromcol : 0;
+        int last = y == to ? tocol : INT_MAX;
+        
+        // Other rows still pointing into the loaded text join the run too
+        if (!row->cap && first == 0 && last == INT_MAX) {
+            if (searchGather(s, row->chars, row->size, y)) return;
+        } else if (searchFlush(s) || searchRow(s, row, y, first, last)) {
+            return;
+        }
+        y++;
+    }
+    searchFlush(s);
+}
+
+static int searchIsRegex() {
+    return E.search && strncmp(E.search, "\\v", 2) == 0;
+}
+
+// Scan chunk c for rows that may hold a match
+static void searchScanChunk(regexDFA *dfa, struct searchChunk *c) {
+    size_t *starts = NULL;
+    int n = 0, cap = 0;
+    
+    regexScan(dfa, c->text, c->len, &starts, &n, &cap);
+    c->lines = malloc(sizeof(int) * (n ? n : 1));
+    c->nlines = n;
+    if (c->copy) {
+        // Rows copied are counted by their line breaks
+        size_t pos = 0;
+        int row = 0;
+        for (int i = 0; i < n; i++) {
+            const char *nl;
+            while (pos < starts[i] && (nl = memchr(&c->text[pos], '\n', starts[i] - pos)) != NULL) {
+                pos = nl - c->text + 1;
+                row++;
+            }
+            c->lines[i] = row;
+        }
+    } else {
+        size_t first = editorLineOf(&E.lines, c->text - E.text);
+        for (int i = 0; i < n; i++)
+            c->lines[i] = editorLineOf(&E.lines, c->text - E.text + starts[i]) - first;
+    }
+    free(starts);
+}
+
+static void *searchWorker(void *arg) {
+    regexDFA *dfa = NULL;
+    unsigned id = 0;
+    (void)arg;
+    
+    pthread_mutex_lock(&searchLock);
+    while (1) {
+        struct searchJob *job = searchJob;
+        struct searchChunk *c = NULL;
+        
+        while (job && !job->cancel && job->next < job->n && !c) {
+            c = &job->chunks[job->order[job->next++]];
+            if (c->state != CHUNK_QUEUED) c = NULL;
+        }
+        if (!c) {
+            pthread_cond_wait(&searchWork, &searchLock);
+            continue;
+        }
+        c->state = CHUNK_TAKEN;
+        job->running++;
+        pthread_mutex_unlock(&searchLock);
+        
+        // Every thread builds its own DFA, so they never wait on each other
+        editorBind(job->owner);
+        if (id != job->id) {
+            regexDFAFree(dfa);
+            dfa = regexDFANew(job->re);
+            id = job->id;
+        }
+        searchScanChunk(dfa, c);
+        
+        pthread_mutex_lock(&searchLock);
+        c->state = CHUNK_DONE;
+        job->running--;
+        pthread_cond_broadcast(&searchDone);
+    }
+    return NULL;
+}
+
+// One thread per core, started for the first regular expression
+static void searchStartThreads() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    if (searchThreads) return;
+    if (n < 1) n = 1;
+    if (n > SEARCH_MAX_THREADS) n = SEARCH_MAX_THREADS;
+    for (int i = 0; i < n; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, searchWorker, NULL) != 0) break;
+        pthread_detach(thread);
+        searchThreads++;
+    }
+}
+
+static void searchChunkAdd(struct searchJob *job, const char *text, size_t len, char *copy, int row) {
+    if (job->n == job->cap) {
+        job->cap = job->cap ? job->cap * 2 : 64;
+        job->chunks = realloc(job->chunks, sizeof(struct searchChunk) * job->cap);
+    }
+    struct searchChunk *c = &job->chunks[job->n++];
+    memset(c, 0, sizeof(*c));
+    c->text = text;
+    c->len = len;
+    c->copy = copy;
+    c->row = row;
+}
+
+// Chunk holding row y
+static int searchChunkOf(struct searchJob *job, int y) {
+    int lo = 0, hi = job->n;
+    
+    while (hi - lo > 1) {
+        int mid = lo + (hi - lo) / 2;
+        if (job->chunks[mid].row <= y)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Cut the rows into chunks and hand them to the threads, the chunk of row
+// y first and then the ones after it in direction dir
+static struct searchJob *searchJobStart(int y, int dir) {
+    struct searchJob *job = calloc(1, sizeof(*job));
+    const char *run = NULL, *runend = NULL;
+    int runrow = 0;
+    char *copy = NULL;
+    size_t copylen = 0, copycap = 0;
+    int copyrow = 0;
+    rowIter it;
+    
+    job->id = ++searchJobs;
+    job->re = searchRegex;
+    job->changes = E.changes;
+    job->owner = editorCurrent;
+    
+    editorRowIterInit(&it, 0, 0);
+    for (int r = 0; r <= E.numrows; ) {
+        const char *text = NULL;
+        size_t line, len = 0;
+        erow *row = NULL;
+        int n = r < E.numrows ? editorRowIterLines(&it, E.numrows - r, &line) : 0;
+        
+        if (n > 0) {
+            size_t start = editorLineStart(&E.lines, line);
+            size_t tail = editorLineSpan(&E.lines, E.text, line + n - 1, &len);
+            text = &E.text[start];
+            len += tail - start;
+        } else if (r < E.numrows && (row = editorRowIterNext(&it)) != NULL) {
+            n = 1;
+            if (!row->cap) {
+                text = row->chars;
+                len = row->size;
+            }
+        }
+        
+        // Edited rows are copied, joined by '\n' like the loaded text
+        if (copy && (!row || !row->cap || copylen >= SEARCH_CHUNK)) {
+            searchChunkAdd(job, copy, copylen, copy, copyrow);
+            copy = NULL;
+        }
+        if (row && row->cap) {
+            if (!copy) {
+                copylen = 0;
+                copycap = 0;
+                copyrow = r;
+            }
+            if (copycap < copylen + row->size + 1) {
+                copycap = copycap ? copycap : 4096;
+                while (copycap < copylen + row->size + 1) copycap *= 2;
+                copy = realloc(copy, copycap);
+            }
+            if (r > copyrow) copy[copylen++] = '\n';
+            memcpy(&copy[copylen], editorRowChars(row), row->size);
+            copylen += row->size;
+        }
+        
+        if (run && (!text || !searchFollows(runend, text) || runend - run >= SEARCH_CHUNK)) {
+            searchChunkAdd(job, run, runend - run, NULL, runrow);
+            run = NULL;
+        }
+        if (text && run) {
+            runend = text + len;
+        } else if (text) {
+            run = text;
+            runend = text + len;
+            runrow = r;
+        }
+        if (n == 0) break;
+        r += n;
+    }
+    
+    int k = searchChunkOf(job, y);
+    job->order = malloc(sizeof(int) * (job->n ? job->n : 1));
+    for (int i = 0; i < job->n; i++)
+        job->order[i] = dir > 0 ? (k + i) % job->n : (k - i + job->n) % job->n;
+    
+    searchStartThreads();
+    pthread_mutex_lock(&searchLock);
+    searchJob = job;
+    pthread_cond_broadcast(&searchWork);
+    pthread_mutex_unlock(&searchLock);
+    return job;
+}
+
+// Stop the threads working on the current job and free it; the rows it
+// was made from are about to change or go away
+void editorSearchClear() {
+    struct searchJob *job = searchJob;
+    
+    if (!job || job->owner != editorCurrent) return;
+    pthread_mutex_lock(&searchLock);
+    job->cancel = 1;
+    while (job->running > 0) pthread_cond_wait(&searchDone, &searchLock);
+    searchJob = NULL;
+    pthread_mutex_unlock(&searchLock);
+    
+    for (int i = 0; i < job->n; i++) {
+        free(job->chunks[i].copy);
+        free(job->chunks[i].lines);
+    }
+    free(job->chunks);
+    free(job->order);
+    free(job);
+}
+
+// Wait until chunk i is scanned, scanning it here if no thread has taken
+// it yet. Returns -1 if a key was typed first and s may be interrupted.
+static int searchAwait(struct searchScan *s, struct searchJob *job, int i) {
+    struct searchChunk *c = &job->chunks[i];
+    
+    pthread_mutex_lock(&searchLock);
+    if (c->state == CHUNK_QUEUED) {
+        c->state = CHUNK_TAKEN;
+        pthread_mutex_unlock(&searchLock);
+        if (searchDFAJob != job->id) {
+            regexDFAFree(searchDFA);
+            searchDFA = regexDFANew(job->re);
+            searchDFAJob = job->id;
+        }
+        searchScanChunk(searchDFA, c);
+        pthread_mutex_lock(&searchLock);
+        c->state = CHUNK_DONE;
+    }
+    while (c->state != CHUNK_DONE) {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_nsec += 10 * 1000000;
+        if (t.tv_nsec >= 1000000000) {
+            t.tv_sec++;
+            t.tv_nsec -= 1000000000;
+        }
+        if (pthread_cond_timedwait(&searchDone, &searchLock, &t) != 0 && s->interruptible) {
+            pthread_mutex_unlock(&searchLock);
+            if (searchKeyTyped(s)) return -1;
+            pthread_mutex_lock(&searchLock);
+        }
+    }
+    pthread_mutex_unlock(&searchLock);
+    s->scanned += c->len;
+    return searchInterrupted(s) ? -1 : 0;
+}
+
+// Column of the first match in row y starting in [from, to), or of the last
+// if last is set; -1 if there is none
+static int searchRegexRow(int y, int from, int to, int last) {
+    rowIter it;
+    erow *row;
+    int col = -1, mlen, at;
+    
+    editorRowIterInit(&it, y, 0);
+    if ((row = editorRowIterNext(&it)) == NULL) return -1;
+    
+    const char *chars = searchChars(row);
+    while ((at = regexFind(searchRegex, chars, row->size, from, &mlen)) >= 0 && at < to) {
+        col = at;
+        if (!last) break;
+        from = at + 1;
+    }
+    return col;
+}
+
+// searchFind() for a regular expression
+static int searchFindRegex(struct searchScan *s, int y, int x, int dir, int *my, int *mx) {
+    struct searchJob *job = searchJob;
+    int col;
+    
+    // The rest of the cursor's row
+    if ((col = searchRegexRow(y, dir > 0 ? x + 1 : 0, dir > 0 ? INT_MAX : x, dir < 0)) >= 0) {
+        *my = y;
+        *mx = col;
+        return 1;
+    }
+    
+    if (!job || job->re != searchRegex || job->changes != E.changes) {
+        editorSearchClear();
+        job = searchJobStart(y, dir);
+    }
+    
+    // Chunks in file order from the cursor's, which comes again at the end
+    // for the rows on its other side
+    int k = searchChunkOf(job, y);
+    for (int i = 0; i <= job->n && job->n > 0; i++) {
+        int ci = dir > 0 ? (k + i) % job->n : (k - i + job->n) % job->n;
+        int wrap = dir > 0 ? k + i >= job->n : k - i < 0;
+        struct searchChunk *c = &job->chunks[ci];
+        
+        if (searchAwait(s, job, ci) < 0) return -1;
+        for (int j = 0; j < c->nlines; j++) {
+            int r = c->row + c->lines[dir > 0 ? j : c->nlines - 1 - j];
+            if (r == y) continue;
+            if (i == 0 && (dir > 0 ? r < y : r > y)) continue;
+            if (i == job->n && (dir > 0 ? r > y : r < y)) continue;
+            
+            // A line may only match with its '\r', so check it
+            if ((col = searchRegexRow(r, 0, INT_MAX, dir < 0)) >= 0) {
+                *my = r;
+                *mx = col;
+                return wrap ? 2 : 1;
+            }
+        }
+    }
+    
+    // The cursor's row up to the cursor, coming back around
+    if ((col = searchRegexRow(y, 0, dir > 0 ? x + 1 : INT_MAX, dir < 0)) >= 0) {
+        *my = y;
+        *mx = col;
+        return 2;
+    }
+    return 0;
+}
+
+// Find the match nearest to (y, x) in direction dir, wrapping around the
+// end of the file. Returns 1 if found, 2 if found after wrapping, 0 if
+// there is none and -1 if a key interrupted the search.
+static int searchFind(int y, int x, int dir, int interruptible, int *my, int *mx) {
+    struct searchScan s = {0};
+    int end = E.numrows - 1;
+    
+    s.pat = E.search;
+    s.len = E.searchlen;
+    s.interruptible = interruptible;
+    s.last = dir < 0;
+    if (!s.pat || s.len == 0 || E.numrows == 0) return 0;
+    if (y > end) {
+        y = end;
+        x = INT_MAX - 1;
+    }
+    if (searchIsRegex()) {
+        if (!searchRegex) return 0;
+        int found = searchFindRegex(&s, y, x, dir, my, mx);
+        return s.interrupted ? -1 : found;
+    }
+    
+    for (int wrap = 0; wrap < 2 && !s.found && !s.interrupted; wrap++) {
+        if (dir > 0 && !wrap) searchRange(&s, y, x + 1, end, INT_MAX);
+        if (dir > 0 && wrap) searchRange(&s, 0, 0, y, x + 1);
+        if (dir < 0 && !wrap) searchRange(&s, 0, 0, y, x);
+        if (dir < 0 && wrap) searchRange(&s, y, x, end, INT_MAX);
+        
+        if (s.found && !s.interrupted) {
+            *my = s.row;
+            *mx = s.col;
+            return wrap ? 2 : 1;
+        }
+    }
+    return s.interrupted ? -1 : 0;
+}
+
+// Compile E.search if it is a regular expression
+static void searchCompile() {
+    editorSearchClear();
+    regexFree(searchRegex);
+    searchRegex = NULL;
+    searchRegexError = NULL;
+    if (searchIsRegex()) searchRegex = regexCompile(E.search + 2, &searchRegexError);
+    editorDamageScreen();
+}
+
+static void searchSetPattern(const char *pattern, int len) {
+    free(E.search);
+    E.search = len ? strndup(pattern, len) : NULL;
+    E.searchlen = len;
+    searchCompile();
+}
+
+// Whether a match starts at (y, x)
+static int searchMatchAt(int y, int x) {
+    if (y >= E.numrows) return 0;
+    if (searchIsRegex()) return searchRegex && searchRegexRow(y, x, x + 1, 0) == x;
+    
+    erow *row = editorRowAt(y);
+    return x + E.searchlen <= row->size && memcmp(&searchChars(row)[x], E.search, E.searchlen) == 0;
+}
+
+static void searchNotFound() {
+    if (searchIsRegex() && !searchRegex)
+        editorSetStatusMessage("Invalid pattern: %s (%s)", E.search, searchRegexError);
+    else
+        editorSetStatusMessage("Pattern not found: %s", E.search);
+}
+
+// / was typed: the search starts from here and goes back here if it is
+// cancelled
+void editorSearchBegin() {
+    searchOriginY = E.cy;
+    searchOriginX = E.cx;
+    searchPrev = E.search;
+    searchPrevLen = E.searchlen;
+    E.search = NULL;
+    E.searchlen = 0;
+    searchComplete = 1;
+}
+
+// Move to the first match of the pattern typed so far. The search gives up
+// when another key comes in, since that key will start a new one.
+void editorSearchUpdate(const char *pattern) {
+    int y, x;
+    
+    searchSetPattern(pattern, strlen(pattern));
+    E.cy = searchOriginY;
+    E.cx = searchOriginX;
+    
+    int found = searchFind(searchOriginY, searchOriginX, 1, 1, &y, &x);
+    if (found > 0) {
+        E.cy = y;
+        E.cx = x;
+    }
+    searchComplete = found >= 0;
+}
+
+// Enter or ESC ended the pattern. An empty pattern searches for the last
+// one again.
+void editorSearchEnd(int accept) {
+    int y, x;
+    
+    if (!accept || !E.search) {
+        free(E.search);
+        E.search = searchPrev;
+        E.searchlen = searchPrevLen;
+        searchComplete = 0;
+        searchCompile();
+    } else {
+        free(searchPrev);
+    }
+    searchPrev = NULL;
+    
+    if (!accept) {
+        E.cy = searchOriginY;
+        E.cx = searchOriginX;
+        return;
+    }
+    if (!E.search) {
+        editorSetStatusMessage("No previous search");
+        return;
+    }
+    
+    if (!searchComplete) {
+        E.cy = searchOriginY;
+        E.cx = searchOriginX;
+        if (searchFind(searchOriginY, searchOriginX, 1, 0, &y, &x) > 0) {
+            E.cy = y;
+            E.cx = x;
+        }
+    }
+    
+    // Whether the cursor sits on a match tells if there is one
+    if (!searchMatchAt(E.cy, E.cx))
+        searchNotFound();
+    else
+        editorSetStatusMessage("/%s", E.search);
+}
+
+// n and N: go to the next or previous match of the last search
+void editorSearchNext(int dir) {
+    int y, x;
+    
+    if (!E.search) {
+        editorSetStatusMessage("No previous search");
+        return;
+    }
+    
+    int found = searchFind(E.cy, E.cx, dir, 0, &y, &x);
+    if (found == 0) {
+        searchNotFound();
+        return;
+    }
+    E.cy = y;
+    E.cx = x;
+    if (found == 2)
+        editorSetStatusMessage(dir > 0 ? "Search hit BOTTOM, continuing at TOP"
+                                       : "Search hit TOP, continuing at BOTTOM");
+    else
+        editorSetStatusMessage("/%s", E.search);
+}
+
+static int searchHighlightRegex(erow *row, unsigned char *hl, int from, int len) {
+    int pos = 0, at, mlen, n = 0;
+    
+    if (!searchRegex) return 0;
+    editorRowRenderUpTo(row, row->rsize);
+    while ((at = regexFind(searchRegex, row->render, row->rsize, pos, &mlen)) >= 0 && at < from + len) {
+        for (int i = at > from ? at : from; i < at + mlen && i < from + len; i++)
+            hl[i - from] = COLOR_MATCH;
+        n += at + mlen > from;
+        pos = at + (mlen ? mlen : 1);
+    }
+    return n;
+}
+
+// Color the matches of the search in render[from, from + len) of a row
+// being drawn
+int editorSearchHighlight(erow *row, unsigned char *hl, int from, int len) {
+    if (!E.search || len <= 0) return 0;
+    if (searchIsRegex()) return searchHighlightRegex(row, hl, from, len);
+    
+    int start = from - (E.searchlen - 1) > 0 ? from - (E.searchlen - 1) : 0;
+    int end = from + len + E.searchlen - 1 < row->rsize ? from + len + E.searchlen - 1 : row->rsize;
+    editorRowRenderUpTo(row, end);
+    const char *p = &row->render[start];
+    int n = 0;
+    
+    while ((p = editorSearchMem(p, &row->render[end] - p, E.search, E.searchlen)) != NULL) {
+        int at = p - row->render;
+        for (int i = at > from ? at : from; i < at + E.searchlen && i < from + len; i++)
+            hl[i - from] = COLOR_MATCH;
+        n++;
+        p++;
+    }
+    return n;
+}
@@ -0,0 +1,205 @@
+#include "axcode.h"
+
+// Timings of the frames painted and the keys answered, collected while
+// E.stats is set. With it unset every hook is a pointer test and nothing
+// is timed. Each series keeps its last STATS_SAMPLES times, which the
+// percentiles are worked out from when they are shown, and counts, sums
+// and the worst of all of them.
+struct statsSeries {
+    uint32_t ns[STATS_SAMPLES]; // Ring of the latest times
+    uint64_t count;
+    uint64_t sum;
+    uint32_t max;
+};
+
+enum statsKind {
+    STATS_FRAME,        // editorRefreshScreen as a whole
+    STATS_DRAW,         // Laying out the rows and the status bar
+    STATS_REFRESH,      // wrefresh sending the changes to the terminal
+    STATS_HIGHLIGHT,    // editorUpdateSyntax during a frame
+    STATS_LATENCY,      // From a key being read to the frame showing it
+    STATS_KINDS
+};
+
+static const char *statsNames[STATS_KINDS] = { "frame", "draw", "refresh", "highlight", "latency" };
+
+struct editorStats {
+    struct statsSeries series[STATS_KINDS];
+    uint64_t highlight;     // editorUpdateSyntax since the frame started
+    uint64_t highlight_all; // and in all, edits included
+    uint64_t key;           // When the oldest key not painted yet was read
+    char *dump;             // File written on exit, if any
+};
+
+uint64_t editorStatsNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void statsAdd(enum statsKind kind, uint64_t ns) {
+    struct statsSeries *s = &E.stats->series[kind];
+    
+    if (ns > UINT32_MAX) ns = UINT32_MAX;
+    s->ns[s->count % STATS_SAMPLES] = ns;
+    s->count++;
+    s->sum += ns;
+    if (ns > s->max) s->max = ns;
+}
+
+void editorStatsStart() {
+    if (!E.stats) E.stats = calloc(1, sizeof(struct editorStats));
+}
+
+void editorStatsStop() {
+    if (!E.stats) return;
+    free(E.stats->dump);
+    free(E.stats);
+    E.stats = NULL;
+}
+
+// A frame starts being painted. Returns when, 0 if nothing is timed.
+uint64_t editorStatsFrameStart() {
+    if (!E.stats) return 0;
+    E.stats->highlight = 0;
+    return editorStatsNow();
+}
+
+// The frame that started at start was laid out at drawn and is now on the
+// terminal, along with every key read before it started
+void editorStatsFrameEnd(uint64_t start, uint64_t drawn) {
+    if (!E.stats || !start) return;
+    
+    uint64_t end = editorStatsNow();
+    statsAdd(STATS_FRAME, end - start);
+    statsAdd(STATS_DRAW, drawn - start);
+    statsAdd(STATS_REFRESH, end - drawn);
+    statsAdd(STATS_HIGHLIGHT, E.stats->highlight);
+    if (E.stats->key && E.stats->key <= start) {
+        statsAdd(STATS_LATENCY, end - E.stats->key);
+        E.stats->key = 0;
+    }
+}
+
+// A key was read; it counts until the next frame is painted
+void editorStatsKey() {
+    if (E.stats && !E.stats->key) E.stats->key = editorStatsNow();
+}
+
+void editorStatsHighlight(uint64_t ns) {
+    E.stats->highlight += ns;
+    E.stats->highlight_all += ns;
+}
+
+static int statsCompare(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Percentiles p[0..n) of a series in milliseconds, 0 if it is empty
+static void statsPercentiles(struct statsSeries *s, const int *p, double *ms, int n) {
+    int len = s->count < STATS_SAMPLES ? (int)s->count : STATS_SAMPLES;
+    uint32_t *sorted = malloc(sizeof(uint32_t) * (len ? len : 1));
+    
+    memcpy(sorted, s->ns, sizeof(uint32_t) * len);
+    qsort(sorted, len, sizeof(uint32_t), statsCompare);
+    for (int i = 0; i < n; i++)
+        ms[i] = len ? sorted[(len - 1) * p[i] / 100] / 1e6 : 0;
+    free(sorted);
+}
+
+// Bytes the loaded rows hold in their own text, render and hl. Rows still
+// pointing into the file hold no text of their own.
+static void statsMemory(size_t *chars, size_t *render, size_t *hl) {
+    rowIter it;
+    erow *row;
+    
+    *chars = *render = *hl = 0;
+    editorRowIterInit(&it, 0, 1);
+    while ((row = editorRowIterNext(&it)) != NULL) {
+        *chars += row->cap;
+        if (row->render) *render += row->rcap;
+        if (row->hl) *hl += row->rcap;
+    }
+}
+
+static const char *statsBytes(char *buf, size_t size, size_t bytes) {
+    if (bytes < 1024)
+        snprintf(buf, size, "%zuB", bytes);
+    else if (bytes < 1024 * 1024)
+        snprintf(buf, size, "%.1fK", bytes / 1024.0);
+    else
+        snprintf(buf, size, "%.1fM", bytes / (1024.0 * 1024));
+    return buf;
+}
+
+// :stats shows the median and 99th percentile of the frame and highlight
+// times, the median, 90th and 99th of the latency, and the bytes held in
+// chars, render and hl
+void editorStatsShow() {
+    if (!E.stats) {
+        editorStatsStart();
+        editorSetStatusMessage("Collecting stats from now on, :stats again to see them");
+        return;
+    }
+    
+    static const int p[] = { 50, 90, 99 };
+    double frame[3], hl[3], key[3];
+    size_t chars, render, hlbytes;
+    char b1[16], b2[16], b3[16];
+    
+    statsPercentiles(&E.stats->series[STATS_FRAME], p, frame, 3);
+    statsPercentiles(&E.stats->series[STATS_HIGHLIGHT], p, hl, 3);
+    statsPercentiles(&E.stats->series[STATS_LATENCY], p, key, 3);
+    statsMemory(&chars, &render, &hlbytes);
+    editorSetStatusMessage("frame %.2f/%.2f hl %.2f/%.2f key %.2f/%.2f/%.2f ms mem %s/%s/%s",
+                           frame[0], frame[2], hl[0], hl[2], key[0], key[1], key[2],
+                           statsBytes(b1, sizeof(b1), chars), statsBytes(b2, sizeof(b2), render),
+                           statsBytes(b3, sizeof(b3), hlbytes));
+}
+
+// Write every counter to path as "name<TAB>value<TAB>unit" lines, as the
+// benchmarks print theirs. Returns 0 if it was written.
+int editorStatsWrite(const char *path) {
+    static const int p[] = { 50, 90, 99 };
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+    
+    for (int k = 0; k < STATS_KINDS; k++) {
+        struct statsSeries *s = &E.stats->series[k];
+        double ms[3];
+        
+        statsPercentiles(s, p, ms, 3);
+        fprintf(fp, "%s.count\t%llu\t%s\n", statsNames[k], (unsigned long long)s->count,
+                k == STATS_LATENCY ? "keys" : "frames");
+        fprintf(fp, "%s.mean\t%.3f\tms\n", statsNames[k], s->count ? s->sum / 1e6 / s->count : 0);
+        for (int i = 0; i < 3; i++)
+            fprintf(fp, "%s.p%d\t%.3f\tms\n", statsNames[k], p[i], ms[i]);
+        fprintf(fp, "%s.max\t%.3f\tms\n", statsNames[k], s->max / 1e6);
+    }
+    fprintf(fp, "highlight.total\t%.3f\tms\n", E.stats->highlight_all / 1e6);
+    
+    size_t chars, render, hl;
+    statsMemory(&chars, &render, &hl);
+    fprintf(fp, "mem.text\t%zu\tbytes\n", E.textsize);
+    fprintf(fp, "mem.chars\t%zu\tbytes\n", chars);
+    fprintf(fp, "mem.render\t%zu\tbytes\n", render);
+    fprintf(fp, "mem.hl\t%zu\tbytes\n", hl);
+    fprintf(fp, "rows\t%d\trows\n", E.numrows);
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+static void statsDumpAtExit() {
+    if (E.stats && E.stats->dump) editorStatsWrite(E.stats->dump);
+}
+
+// :set statsfile=path collects stats and writes them to path on exit
+void editorStatsDumpOnExit(const char *path) {
+    static int registered;
+    
+    editorStatsStart();
+    free(E.stats->dump);
+    E.stats->dump = strdup(path);
+    if (!registered) atexit(statsDumpAtExit);
+    registered = 1;
+}
@@ -0,0 +1,258 @@
+#include "axcode.h"
+
+// :s/pat/rep/[g] and :%s. The new text of a row is put together in a
+// scratch buffer with all its replacements made and handed to the row in
+// one go, so the row is allocated, highlighted and marked edited once
+// however many matches it holds. With :%s, rows still pointing into the
+// loaded file are searched as the blocks of text they are part of, the way
+// / does, and only the lines with a match are loaded to be rewritten.
+struct subst {
+    char *pat;          // Pattern, after \v if it is a regular expression
+    size_t patlen;
+    regex *re;          // Compiled pattern if it started with \v
+    regexDFA *dfa;      // To find the lines of the loaded text to rewrite
+    char *rep;          // Replacement with its escapes taken out
+    size_t replen;
+    size_t *amp;        // Offsets in rep where the match goes, for &
+    int namp;
+    int global;         // Replace every match in a row rather than the first
+    char *buf;          // New text of the row being rewritten
+    size_t len, cap;
+    int count, rows;    // Replacements made and rows they were made in
+    int last;           // Last row rewritten
+};
+
+static void substFree(struct subst *s) {
+    free(s->pat);
+    regexFree(s->re);
+    regexDFAFree(s->dfa);
+    free(s->rep);
+    free(s->amp);
+    free(s->buf);
+}
+
+static void substAppend(struct subst *s, const char *text, size_t len) {
+    if (len == 0) return;
+    
+    if (s->cap < s->len + len) {
+        size_t cap = s->cap ? s->cap : 256;
+        while (cap < s->len + len) cap *= 2;
+        s->buf = realloc(s->buf, cap);
+        s->cap = cap;
+    }
+    memcpy(&s->buf[s->len], text, len);
+    s->len += len;
+}
+
+// Copy the pattern from *p up to an unescaped delim, taking the backslash
+// out of \delim only so the escapes of a regular expression are kept
+static char *substPattern(const char **p, int delim, size_t *len) {
+    const char *q = *p;
+    char *out = malloc(strlen(q) + 1);
+    size_t n = 0;
+    
+    while (*q && *q != delim) {
+        if (q[0] == '\\' && q[1] == delim) q++;
+        else if (q[0] == '\\' && q[1]) out[n++] = *q++;
+        out[n++] = *q++;
+    }
+    if (*q) q++;
+    out[n] = '\0';
+    *len = n;
+    *p = q;
+    return out;
+}
+
+// Copy the replacement from *p up to an unescaped delim. & stands for the
+// match, \t for a tab and a backslash takes any other character as it is.
+static void substReplacement(struct subst *s, const char **p, int delim) {
+    const char *q = *p;
+    size_t n = strlen(q);
+    
+    s->rep = malloc(n + 1);
+    s->amp = malloc(sizeof(size_t) * (n + 1));
+    while (*q && *q != delim) {
+        if (q[0] == '&') {
+            s->amp[s->namp++] = s->replen;
+        } else if (q[0] == '\\' && q[1]) {
+            q++;
+            s->rep[s->replen++] = *q == 't' ? '\t' : *q;
+        } else {
+            s->rep[s->replen++] = *q;
+        }
+        q++;
+    }
+    if (*q) q++;
+    *p = q;
+}
+
+// First match in text[from, len); returns where it starts, or -1
+static int substFind(struct subst *s, const char *text, int len, int from, int *mlen) {
+    if (s->re) return regexFind(s->re, text, len, from, mlen);
+    
+    const char *hit = editorSearchMem(&text[from], len - from, s->pat, s->patlen);
+    *mlen = s->patlen;
+    return hit ? hit - text : -1;
+}
+
+// Rewrite row y with the matches in it replaced
+static void substRow(struct subst *s, erow *row, int y) {
+    const char *text = row->cap ? editorRowChars(row) : row->chars;
+    int pos = 0, prev = -1, count = 0, at, mlen;
+    
+    s->len = 0;
+    while (pos <= row->size && (at = substFind(s, text, row->size, pos, &mlen)) >= 0) {
+        // An empty match right after the last match is no new match
+        if (mlen == 0 && at == prev) {
+            if (at >= row->size) break;
+            substAppend(s, &text[at], 1);
+            pos = at + 1;
+            continue;
+        }
+        
+        size_t from = 0;
+        substAppend(s, &text[pos], at - pos);
+        for (int i = 0; i < s->namp; i++) {
+            substAppend(s, &s->rep[from], s->amp[i] - from);
+            substAppend(s, &text[at], mlen);
+            from = s->amp[i];
+        }
+        substAppend(s, &s->rep[from], s->replen - from);
+        count++;
+        pos = prev = at + mlen;
+        if (!s->global) break;
+        
+        // An empty match moves on by one character
+        if (mlen == 0) {
+            if (at >= row->size) break;
+            substAppend(s, &text[at], 1);
+            pos++;
+        }
+    }
+    if (count == 0) return;
+    
+    if (pos < row->size) substAppend(s, &text[pos], row->size - pos);
+    editorRowSetText(row, s->buf, s->len);
+    s->count += count;
+    s->rows++;
+    s->last = y;
+}
+
+// Find the lines of the loaded text text[0, len) that may hold a match and
+// append them to *lines
+static void substScan(struct subst *s, const char *text, size_t len, size_t **lines, int *n, int *cap) {
+    size_t base = text - E.text;
+    
+    if (s->re) {
+        int first = *n;
+        regexScan(s->dfa, text, len, lines, n, cap);
+        for (int i = first; i < *n; i++)
+            (*lines)[i] = editorLineOf(&E.lines, base + (*lines)[i]);
+        return;
+    }
+    
+    const char *p = text, *end = text + len;
+    while ((p = editorSearchMem(p, end - p, s->pat, s->patlen)) != NULL) {
+        if (*n == *cap) {
+            *cap = *cap ? *cap * 2 : 64;
+            *lines = realloc(*lines, sizeof(size_t) * *cap);
+        }
+        size_t line = editorLineOf(&E.lines, p - E.text);
+        (*lines)[(*n)++] = line;
+        
+        // Go on from the next line, a row is rewritten once
+        size_t next = editorLineStart(&E.lines, line + 1);
+        if (next >= base + len) break;
+        p = &E.text[next];
+    }
+}
+
+// Rewrite every row with a match. Rows that are not loaded are only loaded
+// if the loaded text says they hold one. Rewriting a row may load the rows
+// after it to carry the lexer state on, so the walk starts again below
+// every row rewritten.
+static void substAll(struct subst *s) {
+    size_t *lines = NULL;
+    int cap = 0;
+    rowIter it;
+    erow *row;
+    
+    if (s->re) s->dfa = regexDFANew(s->re);
+    editorRowIterInit(&it, 0, 0);
+    for (int y = 0; y < E.numrows; ) {
+        size_t line, len;
+        int n = editorRowIterLines(&it, E.numrows - y, &line);
+        if (n > 0) {
+            size_t start = editorLineStart(&E.lines, line);
+            size_t tail = editorLineSpan(&E.lines, E.text, line + n - 1, &len);
+            int nlines = 0;
+            
+            substScan(s, &E.text[start], tail + len - start, &lines, &nlines, &cap);
+            for (int i = 0; i < nlines; i++)
+                substRow(s, editorRowAt(y + (lines[i] - line)), y + (lines[i] - line));
+            y += n;
+            if (nlines > 0) editorRowIterInit(&it, y, 0);
+            continue;
+        }
+        
+        if ((row = editorRowIterNext(&it)) == NULL) break;
+        int rows = s->rows;
+        substRow(s, row, y++);
+        if (s->rows > rows) editorRowIterInit(&it, y, 0);
+    }
+    free(lines);
+}
+
+// Run :s, or :%s if command starts with %. The delimiter is whatever
+// follows the s; an empty pattern is the last one searched for.
+void editorSubstitute(const char *command) {
+    struct subst s = {0};
+    int all = command[0] == '%';
+    const char *p = command + (all ? 2 : 1);
+    int delim = *p++;
+    
+    s.pat = substPattern(&p, delim, &s.patlen);
+    substReplacement(&s, &p, delim);
+    for (; *p; p++) {
+        if (*p != 'g') {
+            editorSetStatusMessage("Trailing characters: %s", p);
+            substFree(&s);
+            return;
+        }
+        s.global = 1;
+    }
+    
+    if (s.patlen == 0) {
+        if (!E.search) {
+            editorSetStatusMessage("No previous search");
+            substFree(&s);
+            return;
+        }
+        free(s.pat);
+        s.pat = strdup(E.search);
+        s.patlen = E.searchlen;
+    }
+    if (strncmp(s.pat, "\\v", 2) == 0) {
+        const char *err;
+        if ((s.re = regexCompile(s.pat + 2, &err)) == NULL) {
+            editorSetStatusMessage("Invalid pattern: %s (%s)", s.pat, err);
+            substFree(&s);
+            return;
+        }
+    }
+    
+    if (all)
+        substAll(&s);
+    else if (E.cy < E.numrows)
+        substRow(&s, editorRowAt(E.cy), E.cy);
+    
+    if (s.count == 0) {
+        editorSetStatusMessage("Pattern not found: %s", s.pat);
+    } else {
+        E.cy = s.last;
+        E.cx = 0;
+        editorSetStatusMessage("%d substitution%s on %d line%s", s.count, s.count == 1 ? "" : "s",
+                               s.rows, s.rows == 1 ? "" : "s");
+    }
+    substFree(&s);
+}
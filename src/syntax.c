@@ -62,248 +62,654 @@ struct editorSyntax HLDB[] = {
 
 #define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
 
-void editorUpdateSyntax(erow *row) {
-    if (row->hl) free(row->hl);
-    row->hl = malloc(row->rsize);
-    memset(row->hl, COLOR_DEFAULT, row->rsize);
+// Character classes used by the lexer
+#define CC_SEP      (1<<0)  // Separator before a keyword or number
+#define CC_WORDEND  (1<<1)  // Ends a word looked up as a keyword
+#define CC_DIGIT    (1<<2)
+#define CC_QUOTE    (1<<3)
+#define CC_SLC      (1<<4)  // First character of the single line comment start
+#define CC_MLCS     (1<<5)  // First character of the multiline comment start
+#define CC_NUMBER   (1<<6)  // Digit or '.', which may start a number
+#define CC_STOP     (CC_SEP | CC_QUOTE | CC_SLC | CC_MLCS | CC_NUMBER)
+
+// What the lexer needs to know about a syntax, worked out once when the
+// syntax is first selected
+struct syntaxTables {
+    unsigned char cls[256];
+    int slc_len, mlcs_len, mlce_len;
+    keywordTable keywords;
+};
+
+// Tables of every entry of HLDB, compiled when a file first uses it. Buffers
+// on other threads may be picking the same syntax at the same time.
+static struct syntaxTables HLDB_tables[HLDB_ENTRIES];
+static pthread_mutex_t syntaxCompileLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void syntaxCompile(struct syntaxTables *t, struct editorSyntax *syntax) {
+    memset(t->cls, 0, sizeof(t->cls));
+    for (const char *p = ",.()+-/*=~%<>[];{} \t\n\v\f\r"; *p; p++)
+        t->cls[(unsigned char)*p] |= CC_SEP;
+    for (const char *p = ",.()+-/*=~%<>[];{} \t\n"; *p; p++)
+        t->cls[(unsigned char)*p] |= CC_WORDEND;
+    t->cls[0] |= CC_SEP | CC_WORDEND;
+    for (int c = '0'; c <= '9'; c++)
+        t->cls[c] |= CC_DIGIT | CC_NUMBER;
+    t->cls['.'] |= CC_NUMBER;
+    t->cls['"'] |= CC_QUOTE;
+    t->cls['\''] |= CC_QUOTE;
     
-    if (E.syntax == NULL) return;
+    t->slc_len = syntax->singleline_comment_start ? strlen(syntax->singleline_comment_start) : 0;
+    t->mlcs_len = t->mlce_len = 0;
+    if (syntax->multiline_comment_start && syntax->multiline_comment_end) {
+        t->mlcs_len = strlen(syntax->multiline_comment_start);
+        t->mlce_len = strlen(syntax->multiline_comment_end);
+    }
+    if (t->slc_len)
+        t->cls[(unsigned char)syntax->singleline_comment_start[0]] |= CC_SLC;
+    if (t->mlcs_len)
+        t->cls[(unsigned char)syntax->multiline_comment_start[0]] |= CC_MLCS;
+    
+    keywordCompile(&t->keywords, syntax);
+}
+
+// Rows an edit re-lexes eagerly before leaving the rest to be lexed lazily
+#define HL_PROPAGATE_MAX 100000
+
+// Lexer states a row can be lexed from other than 0, between tokens right
+// after a separator, and 1, inside a multiline comment: inside a single
+// line comment, or inside a string, the state being its quote character.
+// Rows only ever start in 0 or 1.
+#define HL_IN_LINE_COMMENT 2
+
+// What lexing part of a row again after an edit goes by besides the old
+// highlighting. old[0, nold) are the marks the row had past the edit,
+// lexing stopping at the first one it reaches in the same state; the marks
+// it passes go into found, unless that is NULL. With more, the text goes on
+// past the end lexed, which lexing must not reach before it stops.
+struct syntaxMarks {
+    const hlMark *old;
+    int nold;
+    hlMarks *found;
+    int more;
+    int end;            // Where lexing stopped
+};
+
+static void syntaxMarkAdd(hlMarks *m, int at, int state) {
+    if (m->n == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 16;
+        m->marks = realloc(m->marks, sizeof(hlMark) * m->cap);
+    }
+    m->marks[m->n].at = at;
+    m->marks[m->n++].state = state;
+}
+
+// Index of the first mark at or after at
+static int syntaxMarkFind(hlMarks *m, int at) {
+    int lo = 0, hi = m->n;
     
-    char **keywords = E.syntax->keywords;
-    char **type_keywords = E.syntax->type_keywords;
-    char **control_keywords = E.syntax->control_keywords;
-    char **operator_patterns = E.syntax->operator_patterns;
-    char *singleline_comment_start = E.syntax->singleline_comment_start;
-    char *multiline_comment_start = E.syntax->multiline_comment_start;
-    char *multiline_comment_end = E.syntax->multiline_comment_end;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (m->marks[mid].at < at)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Next place past i lexing has to look at the marks: the next old mark, or
+// a window past the last mark found
+static int syntaxMarkStop(struct syntaxMarks *m, int i, int marked) {
+    while (m->nold && m->old->at <= i) {
+        m->old++;
+        m->nold--;
+    }
+    int stop = m->nold ? m->old->at : INT_MAX;
+    if (m->found && marked + HL_EDIT_WINDOW < stop) stop = marked + HL_EDIT_WINDOW;
+    return stop;
+}
+
+// Highlight text[i, len) into hl, starting in lexer state `in` and return
+// the state at the end of the line, 0 or 1. Characters are classified
+// through the syntax's table, and runs inside comments and strings are
+// colored in one go. hl[settle, len) may hold the highlighting the same
+// text had before an edit in front of it: lexing stops at the first
+// separator from settle on that was plain text then too, as the lexer is
+// back in step with the old highlighting there, and -1 is returned. With
+// m, it also stops at old marks and finds new ones as described there,
+// returning -2 if it had more to lex than it was given.
+static int syntaxLexFrom(const char *text, int len, unsigned char *hl, int i, int in, int settle,
+                         struct syntaxMarks *m) {
+    if (E.syntax == NULL) {
+        memset(&hl[i], COLOR_DEFAULT, len - i);
+        return 0;
+    }
     
+    struct syntaxTables *t = &HLDB_tables[E.syntax - HLDB];
+    const unsigned char *cls = t->cls;
+    const char *mlce = E.syntax->multiline_comment_end;
+    int numbers = E.syntax->flags & HL_HIGHLIGHT_NUMBERS;
+    int maxlen = t->keywords.maxlen;
     int prev_sep = 1; // True if previous character was a separator
-    int in_string = 0; // Inside a string
-    int in_comment = row->hl_open_comment; // Inside a comment that continues from previous line
+    int more = m && m->more;
     
-    // If this row continues a comment from the previous line
-    if (row->hl_open_comment && multiline_comment_end) {
-        row->hl_open_comment = 0;
-        int in_ml_comment = 1;
-        
-        for (int i = 0; i < row->rsize; i++) {
-            if (in_ml_comment) {
-                row->hl[i] = COLOR_COMMENT;
-                
-                // Check for end of multiline comment
-                if (strncmp(&row->render[i], multiline_comment_end, 
-                          strlen(multiline_comment_end)) == 0) {
-                    for (unsigned int j = 0; j < strlen(multiline_comment_end); j++) {
-                        row->hl[i+j] = COLOR_COMMENT;
-                    }
-                    i += strlen(multiline_comment_end) - 1;
-                    in_ml_comment = 0;
-                    prev_sep = 1;
-                    continue;
-                }
-            } else {
-                // Process other syntax elements...
-                break;
-            }
-        }
-        
-        // If we reached end of line and still in comment
-        if (in_ml_comment) {
-            row->hl_open_comment = 1;
-        }
+    if (in == 1 && !t->mlce_len) {
+        memset(&hl[i], COLOR_COMMENT, len - i);
+        return more ? -2 : 0;
     }
     
-    int i = 0;
-    while (i < row->rsize) {
-        char c = row->render[i];
-        unsigned char prev_hl = (i > 0) ? row->hl[i-1] : COLOR_DEFAULT;
-        
-        // Handle comments (skip if we're in a string)
-        if (singleline_comment_start && !in_string && !in_comment &&
-            strncmp(&row->render[i], singleline_comment_start, 
-                   strlen(singleline_comment_start)) == 0) {
-            // This is a comment until end of line
-            memset(&row->hl[i], COLOR_COMMENT, row->rsize - i);
-            break;
+    // Lexing a whole line, plain text is colored up front in one go; after
+    // an edit the old colors are still needed
+    int settling = settle < len;
+    if (!settling) memset(&hl[i], COLOR_DEFAULT, len - i);
+    
+    // With more text to come, lexing only stops where no token it lexed
+    // could have looked past len
+    int last = more ? len - (maxlen + t->slc_len + t->mlcs_len + t->mlce_len + 2) : INT_MAX;
+    int marked = i;
+    int stop = m ? syntaxMarkStop(m, i, marked) : INT_MAX;
+    
+    while (i < len) {
+        if (i >= stop && (in || prev_sep)) {
+            // A place lexing could start again from
+            if (m->nold && m->old->at == i && m->old->state == in && i >= settle && i <= last) {
+                m->end = i;
+                return -1;
+            }
+            if (m->found && i >= marked + HL_EDIT_WINDOW) {
+                syntaxMarkAdd(m->found, i, in);
+                marked = i;
+            }
+            stop = syntaxMarkStop(m, i, marked);
         }
         
-        // Handle multiline comments
-        if (multiline_comment_start && multiline_comment_end && !in_string && !in_comment) {
-            if (strncmp(&row->render[i], multiline_comment_start,
-                       strlen(multiline_comment_start)) == 0) {
-                in_comment = 1;
-                for (unsigned int j = 0; j < strlen(multiline_comment_start); j++) {
-                    row->hl[i+j] = COLOR_COMMENT;
-                }
-                i += strlen(multiline_comment_start);
+        if (in == 1) {
+            // Inside a multiline comment: look for its end
+            int start = i, end = stop < len ? stop : len;
+            const char *p;
+            while ((p = memchr(&text[i], mlce[0], end - i)) != NULL) {
+                i = p - text;
+                if (i + t->mlce_len <= len && memcmp(p, mlce, t->mlce_len) == 0) break;
+                i++;
+            }
+            if (!p) {
+                memset(&hl[start], COLOR_COMMENT, end - start);
+                i = end;
                 continue;
             }
+            i += t->mlce_len;
+            memset(&hl[start], COLOR_COMMENT, i - start);
+            in = 0;
+            prev_sep = 1;
+            continue;
         }
-        
-        if (in_comment) {
-            row->hl[i] = COLOR_COMMENT;
-            
-            if (multiline_comment_end && strncmp(&row->render[i], multiline_comment_end,
-                                            strlen(multiline_comment_end)) == 0) {
-                for (unsigned int j = 0; j < strlen(multiline_comment_end); j++) {
-                    row->hl[i+j] = COLOR_COMMENT;
+        if (in == HL_IN_LINE_COMMENT) {
+            int end = stop < len ? stop : len;
+            memset(&hl[i], COLOR_COMMENT, end - i);
+            i = end;
+            continue;
+        }
+        if (in) {
+            // A string runs to its closing quote or the end of the line
+            int start = i, end = stop < len ? stop : len;
+            while (i < end) {
+                if (text[i] == '\\' && i + 1 < len) {
+                    i += 2;
+                    continue;
+                }
+                if (text[i++] == (char)in) {
+                    in = 0;
+                    prev_sep = 1;
+                    break;
                 }
-                i += strlen(multiline_comment_end);
-                in_comment = 0;
-                prev_sep = 1;
-                continue;
             }
-            i++;
+            memset(&hl[start], COLOR_STRING, i - start);
             continue;
         }
         
-        // Handle strings
-        if (in_string) {
-            row->hl[i] = COLOR_STRING;
-            if (c == '\\' && i + 1 < row->rsize) {
-                row->hl[i+1] = COLOR_STRING;
-                i += 2;
-                continue;
-            }
-            if (c == in_string) in_string = 0;
-            i++;
-            prev_sep = 1;
+        // Plain characters in the middle of a word need no more than this
+        if (!prev_sep) {
+            int start = i;
+            while (i < len && !(cls[(unsigned char)text[i]] & CC_STOP)) i++;
+            if (settling) memset(&hl[start], COLOR_DEFAULT, i - start);
+        }
+        if (i == len) break;
+        
+        unsigned char c = text[i];
+        int cc = cls[c];
+        
+        if ((cc & CC_SLC) && i + t->slc_len <= len &&
+            memcmp(&text[i], E.syntax->singleline_comment_start, t->slc_len) == 0) {
+            in = HL_IN_LINE_COMMENT;
             continue;
-        } else if (c == '"' || c == '\'') {
-            in_string = c;
-            row->hl[i] = COLOR_STRING;
-            i++;
+        }
+        
+        if ((cc & CC_MLCS) && t->mlcs_len && i + t->mlcs_len <= len &&
+            memcmp(&text[i], E.syntax->multiline_comment_start, t->mlcs_len) == 0) {
+            memset(&hl[i], COLOR_COMMENT, t->mlcs_len);
+            i += t->mlcs_len;
+            in = 1;
             continue;
         }
         
-        // Handle numbers (if flag is set)
-        if ((E.syntax->flags & HL_HIGHLIGHT_NUMBERS) &&
-            (isdigit(c) || (c == '.' && i+1 < row->rsize && isdigit(row->render[i+1]))) &&
-            (prev_sep || prev_hl == COLOR_NUMBER)) {
-            row->hl[i] = COLOR_NUMBER;
-            i++;
-            prev_sep = 0;
+        if (cc & CC_QUOTE) {
+            hl[i++] = COLOR_STRING;
+            in = c;
             continue;
         }
         
-        // Check if current character is a separator
-        if (strchr(",.()+-/*=~%<>[];{}", c) != NULL || isspace(c)) {
-            prev_sep = 1;
-        } else {
+        if (numbers && (cc & CC_NUMBER) &&
+            ((cc & CC_DIGIT) || (i + 1 < len && (cls[(unsigned char)text[i + 1]] & CC_DIGIT))) &&
+            (prev_sep || (i > 0 && hl[i - 1] == COLOR_NUMBER))) {
+            hl[i++] = COLOR_NUMBER;
             prev_sep = 0;
+            continue;
         }
         
-        // Check for operator patterns (AxScript specific)
-        if (operator_patterns) {
-            int is_op = 0;
-            for (int j = 0; operator_patterns[j]; j++) {
-                if (strncmp(&row->render[i], operator_patterns[j], strlen(operator_patterns[j])) == 0 &&
-                    (i == 0 || strchr(",.()+-/*=~%<>[];{} \t\n", row->render[i-1]) != NULL)) {
-                    
-                    int len = strlen(operator_patterns[j]);
-                    int is_boolean = 0;
-                    
-                    if (len > 0 && operator_patterns[j][len-1] == '|') {
-                        is_boolean = 1;
-                        len--;
-                    }
-                    
-                    for (int k = 0; k < len; k++) {
-                        row->hl[i+k] = is_boolean ? COLOR_BOOLEAN : COLOR_OPERATOR;
-                    }
-                    
-                    i += len;
-                    is_op = 1;
-                    break;
-                }
-            }
-            if (is_op) continue;
-        }
+        // Keywords and word operators are whole words starting after a
+        // separator, found with one lookup in the compiled table
+        int word_start = prev_sep;
+        prev_sep = cc & CC_SEP;
         
-        // Check for keywords, types, and control keywords
-        if (prev_sep) {
-            // Regular keywords
-            if (keywords) {
-                for (int j = 0; keywords[j]; j++) {
-                    int klen = strlen(keywords[j]);
-                    int kw2 = 0;
-                    
-                    if (keywords[j][klen-1] == '|') {
-                        kw2 = 1;
-                        klen--;
-                    }
-                    
-                    if (strncmp(&row->render[i], keywords[j], klen) == 0 &&
-                        (i + klen == row->rsize || 
-                         strchr(",.()+-/*=~%<>[];{} \t\n", row->render[i+klen]) != NULL)) {
-                        
-                        for (int k = 0; k < klen; k++) {
-                            row->hl[i+k] = kw2 ? COLOR_TYPE : COLOR_KEYWORD;
-                        }
-                        i += klen;
-                        break;
-                    }
-                }
-            }
-            
-            // Type keywords
-            if (type_keywords) {
-                for (int j = 0; type_keywords[j]; j++) {
-                    int klen = strlen(type_keywords[j]);
-                    
-                    if (strncmp(&row->render[i], type_keywords[j], klen) == 0 &&
-                        (i + klen == row->rsize || 
-                         strchr(",.()+-/*=~%<>[];{} \t\n", row->render[i+klen]) != NULL)) {
-                        
-                        for (int k = 0; k < klen; k++) {
-                            row->hl[i+k] = COLOR_TYPE;
-                        }
-                        i += klen;
-                        break;
-                    }
-                }
-            }
-            
-            // Control keywords
-            if (control_keywords) {
-                for (int j = 0; control_keywords[j]; j++) {
-                    int klen = strlen(control_keywords[j]);
-                    
-                    if (strncmp(&row->render[i], control_keywords[j], klen) == 0 &&
-                        (i + klen == row->rsize || 
-                         strchr(",.()+-/*=~%<>[];{} \t\n", row->render[i+klen]) != NULL)) {
-                        
-                        for (int k = 0; k < klen; k++) {
-                            row->hl[i+k] = COLOR_CONTROL;
-                        }
-                        i += klen;
-                        break;
-                    }
-                }
-            }
+        if (word_start && !prev_sep && maxlen) {
+            int wlen = 1;
+            while (i + wlen < len && wlen <= maxlen &&
+                   !(cls[(unsigned char)text[i + wlen]] & CC_WORDEND))
+                wlen++;
             
-            if (i < row->rsize) {
-                row->hl[i] = COLOR_DEFAULT;
-                i++;
+            int color = keywordFind(&t->keywords, &text[i], wlen);
+            if (color) {
+                memset(&hl[i], color, wlen);
+                i += wlen;
                 continue;
             }
         }
-        
-        // Default coloring for other characters
-        row->hl[i] = COLOR_DEFAULT;
+        if (settling) {
+            if (prev_sep && i >= settle && i <= last && hl[i] == COLOR_DEFAULT) {
+                if (m) m->end = i;
+                return -1;
+            }
+            hl[i] = COLOR_DEFAULT;
+        }
         i++;
     }
     
-    // Update open comment status for the next row
-    if (in_comment && multiline_comment_end) {
-        row->hl_open_comment = 1;
-    } else {
+    // Open comment status for the next row
+    if (more) return -2;
+    return in == 1;
+}
+
+static int syntaxLex(const char *text, int len, unsigned char *hl, int in) {
+    return syntaxLexFrom(text, len, hl, 0, in, INT_MAX, NULL);
+}
+
+// Lex a row the edits of which need marks whole, finding them on the way
+static void syntaxRowMark(erow *row) {
+    struct syntaxMarks m = { NULL, 0, &E.hl_marks, 0, 0 };
+    
+    editorRowRenderUpTo(row, row->rsize);
+    E.hl_marks.n = 0;
+    row->hl_open_comment = syntaxLexFrom(row->render, row->rsize, row->hl, 0, row->hl_in > 0, INT_MAX, &m);
+    E.hl_marks_row = row;
+}
+
+// Highlight a row again after len bytes were inserted into its render at
+// at, or -len deleted from there, the rest of render and hl having been
+// moved along with them. Lexing starts after the last separator before the
+// edit that was lexed as plain text, where the lexer was between tokens
+// and whose lookahead did not reach the edit, and stops once it is back in
+// step with the old highlighting after it, so typing into a long line only
+// lexes the tokens around the cursor. Where there is no such separator in
+// the HL_EDIT_WINDOW bytes before the edit, as inside a long comment or
+// string, the row is lexed whole once and gets marks about every window,
+// which say what state the lexer is in there. Lexing then starts at the
+// last mark before the edit and stops at the first one after it the lexer
+// reaches in the same state, and the marks are kept up to date as long as
+// only this row is typed into.
+static void syntaxRowEdit(erow *row, int at, int len) {
+    struct syntaxTables *t = &HLDB_tables[E.syntax - HLDB];
+    int reach = 2;
+    if (t->slc_len > reach) reach = t->slc_len;
+    if (t->mlcs_len > reach) reach = t->mlcs_len;
+    if (t->mlce_len > reach) reach = t->mlce_len;
+    
+    // E.changes counts this edit already
+    hlMarks *marks = &E.hl_marks;
+    int have_marks = E.hl_marks_row == row && E.hl_marks_changes + 1 == E.changes;
+    E.hl_marks_changes = E.changes;
+    if (!have_marks) E.hl_marks_row = NULL;
+    if (have_marks) {
+        // Marks past the edit move along with the text, those in deleted
+        // text go
+        int i = syntaxMarkFind(marks, at), j = i;
+        for (; j < marks->n; j++) {
+            if (len < 0 && marks->marks[j].at < at - len) continue;
+            marks->marks[i] = marks->marks[j];
+            marks->marks[i++].at += len;
+        }
+        marks->n = i;
+    }
+    
+    int from = at - reach, floor = from - HL_EDIT_WINDOW, in = 0;
+    while (from > 0 && from > floor && !((t->cls[(unsigned char)row->render[from - 1]] & CC_WORDEND) &&
+                                         row->hl[from - 1] == COLOR_DEFAULT))
+        from--;
+    if (from <= 0) {
+        from = 0;
+        in = row->hl_in > 0;
+    } else if (from == floor && !((t->cls[(unsigned char)row->render[from - 1]] & CC_WORDEND) &&
+                                  row->hl[from - 1] == COLOR_DEFAULT)) {
+        if (!have_marks) {
+            syntaxRowMark(row);
+            return;
+        }
+        int k = syntaxMarkFind(marks, at - reach + 1);
+        from = k ? marks->marks[k - 1].at : 0;
+        in = k ? marks->marks[k - 1].state : row->hl_in > 0;
+    }
+    
+    int settle = len > 0 ? at + len : at;
+    struct syntaxMarks m = { NULL, 0, NULL, row->rgap < row->rsize, row->rsize };
+    if (have_marks) {
+        int k = syntaxMarkFind(marks, settle);
+        m.old = &marks->marks[k];
+        m.nold = marks->n - k;
+        m.found = &E.hl_lexed;
+        E.hl_lexed.n = 0;
+    }
+    int out = syntaxLexFrom(row->render, row->rgap, row->hl, from, in, settle, &m);
+    
+    if (out == -2) {
+        // The edit changed the highlighting further than the gap: lex on
+        // past it, stopping only where the old highlighting is left
+        int gap = row->rgap;
+        editorRowRenderUpTo(row, row->rsize);
+        m.more = 0;
+        if (have_marks) {
+            int k = syntaxMarkFind(marks, gap);
+            m.old = &marks->marks[k];
+            m.nold = marks->n - k;
+            E.hl_lexed.n = 0;
+        }
+        out = syntaxLexFrom(row->render, row->rsize, row->hl, from, in, gap, &m);
+    }
+    if (out >= 0) {
+        row->hl_open_comment = out;
+        m.end = row->rsize;
+    }
+    
+    if (have_marks) {
+        // The marks lexing found take the place of those from where it
+        // started to where it stopped
+        int lo = syntaxMarkFind(marks, from), hi = syntaxMarkFind(marks, m.end);
+        int n = lo + E.hl_lexed.n + marks->n - hi;
+        if (n > marks->cap) {
+            marks->cap = n;
+            marks->marks = realloc(marks->marks, sizeof(hlMark) * n);
+        }
+        if (n > 0) {
+            memmove(&marks->marks[lo + E.hl_lexed.n], &marks->marks[hi], sizeof(hlMark) * (marks->n - hi));
+            if (E.hl_lexed.n) memcpy(&marks->marks[lo], E.hl_lexed.marks, sizeof(hlMark) * E.hl_lexed.n);
+        }
+        marks->n = n;
+    }
+}
+
+void editorSyntaxRowEdit(erow *row, int at, int len) {
+    uint64_t start = E.stats ? editorStatsNow() : 0;
+    
+    if (E.syntax == NULL) {
+        if (len > 0) memset(&row->hl[at], COLOR_DEFAULT, len);
         row->hl_open_comment = 0;
+    } else {
+        syntaxRowEdit(row, at, len);
+    }
+    if (start) editorStatsHighlight(editorStatsNow() - start);
+}
+
+void editorUpdateSyntax(erow *row) {
+    // Marks of the row no longer fit the highlighting
+    if (row == E.hl_marks_row) E.hl_marks_row = NULL;
+    if (!E.stats) {
+        row->hl_open_comment = syntaxLex(row->render, row->rsize, row->hl, row->hl_in > 0);
+        return;
+    }
+    
+    uint64_t start = editorStatsNow();
+    row->hl_open_comment = syntaxLex(row->render, row->rsize, row->hl, row->hl_in > 0);
+    editorStatsHighlight(editorStatsNow() - start);
+}
+
+// Whether rows can start in any state other than 0
+static int syntaxHasState() {
+    return E.syntax && E.syntax->multiline_comment_start && E.syntax->multiline_comment_end;
+}
+
+// Lexer state at the end of a row that starts in state in. The row's own
+// highlighting is used if it was done from that state and left alone if not.
+static int syntaxRowState(erow *row, int in) {
+    if (row->render && row->hl_in == in) return row->hl_open_comment;
+    
+    // The state can only change on a row holding the first character of
+    // the delimiter that would change it
+    int tail = row->size - row->gap;
+    char c = in ? E.syntax->multiline_comment_end[0] : E.syntax->multiline_comment_start[0];
+    if (!memchr(row->chars, c, row->gap) && !memchr(&row->chars[row->cap - tail], c, tail))
+        return in;
+    
+    if (E.lex_cap < row->size + 1) {
+        E.lex_cap = row->size + 1;
+        E.lex_text = realloc(E.lex_text, E.lex_cap);
+        E.lex_hl = realloc(E.lex_hl, E.lex_cap);
+    }
+    
+    // Only text split by a gap has to be copied to be lexed
+    const char *chars = row->chars;
+    if (tail) {
+        memcpy(E.lex_text, row->chars, row->gap);
+        memcpy(&E.lex_text[row->gap], &row->chars[row->cap - tail], tail);
+        chars = E.lex_text;
     }
+    return syntaxLex(chars, row->size, E.lex_hl, in);
+}
+
+// Lexer state row at starts in. Rows are lexed forward from the nearest
+// checkpoint that is still good, saving checkpoints on the way, so after a
+// jump only the rows back to that checkpoint are lexed, and only once.
+// Lexer state at the start of row at, lexing rows from the closest
+// checkpoint above it. Lexing stops early, once a row takes the bytes
+// lexed past budget or *stop is set, leaving E.hl_stale at the row reached
+// and the state there in E.hl_resume, so the next slice carries on from it
+// rather than from the start of its leaf.
+static int syntaxStateAt(int at, size_t budget, const int *stop) {
+    if (at <= 0 || at >= E.numrows || !syntaxHasState()) return 0;
+    
+    // Checkpoints of leaves starting at or after E.hl_stale may be wrong
+    int start;
+    int state = editorRowTreeCheckpoint(at < E.hl_stale ? at : E.hl_stale - 1, &start);
+    while (state < 0)
+        state = editorRowTreeCheckpoint(start - 1, &start);
+    if (E.hl_resume > start && E.hl_resume == E.hl_stale - 1 && E.hl_resume <= at &&
+        E.hl_resume_changes == E.changes) {
+        start = E.hl_resume;
+        state = E.hl_resume_state;
+    }
+    
+    rowIter it;
+    erow *row;
+    editorRowIterInit(&it, start, 0);
+    
+    // Only rows past those known already count, so every slice gets on
+    size_t lexed = 0;
+    int known = E.hl_stale - 1, i = start;
+    for (; i < at && (row = editorRowIterNext(&it)) != NULL; i++) {
+        if (i >= known && (lexed >= budget || __atomic_load_n(stop, __ATOMIC_ACQUIRE))) break;
+        editorRowIterCheckpoint(&it, state);
+        if (row->render && row->hl_in != state) row->hl_in = -1;
+        state = syntaxRowState(row, state);
+        if (i >= known) lexed += row->size;
+    }
+    
+    if (E.hl_stale <= i) E.hl_stale = i + 1;
+    if (E.hl_stale == i + 1) {
+        E.hl_resume = i;
+        E.hl_resume_state = state;
+        E.hl_resume_changes = E.changes;
+    }
+    return state;
+}
+
+int editorSyntaxStateAt(int at) {
+    static const int never = 0;
+    return syntaxStateAt(at, SIZE_MAX, &never);
+}
+
+// The incoming lexer state of row at and the rows after it may have changed
+void editorSyntaxInvalidate(int at) {
+    if (at < 1) at = 1;
+    if (at < E.hl_stale) E.hl_stale = at;
+}
+
+// Row at now starts in state new where it used to start in state old. Both
+// are carried down together, re-highlighting rendered rows and updating
+// checkpoints, until a row ends in the same state either way: the rows
+// after it are unaffected, so only the rows whose state changed are lexed.
+void editorSyntaxPropagate(int at, int old, int new) {
+    rowIter it;
+    erow *row;
+    int n = 0;
+    
+    editorRowIterInit(&it, at, 0);
+    for (int i = at; old != new && i < E.hl_stale && (row = editorRowIterNext(&it)) != NULL; i++) {
+        if (n++ == HL_PROPAGATE_MAX) {
+            editorSyntaxInvalidate(i);
+            return;
+        }
+        
+        editorRowIterCheckpoint(&it, new);
+        if (row->render && row->hl_in == old) {
+            old = row->hl_open_comment;
+            row->hl_in = new;
+            editorRowRenderUpTo(row, row->rsize);
+            editorUpdateSyntax(row);
+            editorDamageRows(i, i);
+            new = row->hl_open_comment;
+        } else {
+            if (row->render) row->hl_in = -1;
+            old = syntaxRowState(row, old);
+            new = syntaxRowState(row, new);
+        }
+    }
+}
+
+// Called after the text of row changed; out is the state it ended in
+// before, or -1 if that is not known
+void editorSyntaxRowChanged(erow *row, int out) {
+    if (!syntaxHasState() || (out >= 0 && row->hl_in >= 0 && row->hl_open_comment == out))
+        return;
+    
+    int at = editorRowIndex(row);
+    if (out < 0 || row->hl_in < 0)
+        editorSyntaxInvalidate(at + 1);
+    else
+        editorSyntaxPropagate(at + 1, out, row->hl_open_comment);
+}
+
+// Called after row at was inserted: the rows below it now start in the
+// state it ends in rather than the one it starts in
+void editorSyntaxInsertRow(int at) {
+    if (at >= E.hl_stale) return;
+    
+    E.hl_stale++;
+    if (!syntaxHasState()) return;
+    
+    int in = editorSyntaxStateAt(at);
+    editorSyntaxPropagate(at + 1, in, syntaxRowState(editorRowAt(at), in));
+}
+
+// Called before row at is deleted: the rows below it will start in the
+// state it starts in rather than the one it ends in
+void editorSyntaxDelRow(int at) {
+    if (at >= E.hl_stale) return;
+    
+    if (syntaxHasState()) {
+        int in = editorSyntaxStateAt(at);
+        editorSyntaxPropagate(at + 1, syntaxRowState(editorRowAt(at), in), in);
+    }
+    if (E.hl_stale > 1) E.hl_stale--;
+}
+
+// Bytes the background lexer lexes before it lets a waiting key through;
+// it also stops between any two rows once a key is pending
+#define HL_WORKER_SLICE (256 * 1024)
+
+// The background lexer and the main loop share the rows under hl_lock. The
+// main loop holds it all the time except while it waits for a key, so the
+// worker always sees the rows in a consistent state and only ever runs
+// while the editor is idle.
+static pthread_mutex_t hl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hl_wake = PTHREAD_COND_INITIALIZER;
+static int hl_worker;
+static int hl_pausing;
+
+static int syntaxWorkerIdle() {
+    return __atomic_load_n(&hl_pausing, __ATOMIC_ACQUIRE) ||
+        !syntaxHasState() || E.hl_stale >= E.numrows;
+}
+
+// Carry the lexer state down the file in slices, advancing E.hl_stale and
+// the leaf checkpoints, so that jumping anywhere finds a checkpoint close
+// by. Stopping after the row being lexed once a key is pending keeps keys
+// answered promptly, however long the rows are.
+static void *syntaxWorker(void *arg) {
+    editorBind(arg);
+    pthread_mutex_lock(&hl_lock);
+    while (1) {
+        while (syntaxWorkerIdle())
+            pthread_cond_wait(&hl_wake, &hl_lock);
+        
+        syntaxStateAt(E.numrows - 1, HL_WORKER_SLICE, &hl_pausing);
+    }
+    return NULL;
+}
+
+// Start the background lexer on the buffer of the calling thread, which
+// holds the rows from now on
+void editorSyntaxStartWorker() {
+    pthread_t thread;
+    
+    pthread_mutex_lock(&hl_lock);
+    if (pthread_create(&thread, NULL, syntaxWorker, editorCurrent) != 0) return;
+    pthread_detach(thread);
+    hl_worker = 1;
+}
+
+// Hand the rows to the background lexer while waiting for input
+void editorSyntaxResume() {
+    if (!hl_worker) return;
+    __atomic_store_n(&hl_pausing, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&hl_wake);
+    pthread_mutex_unlock(&hl_lock);
+}
+
+// Take the rows back, waiting for the slice being lexed to finish
+void editorSyntaxPause() {
+    if (!hl_worker) return;
+    __atomic_store_n(&hl_pausing, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&hl_lock);
 }
 
 void editorSelectSyntaxHighlight() {
     E.syntax = NULL;
+    
+    // Rows highlighted so far are highlighted again when next drawn
+    rowIter it;
+    erow *row;
+    editorRowIterInit(&it, 0, 1);
+    while ((row = editorRowIterNext(&it)) != NULL)
+        row->hl_in = -1;
+    E.hl_stale = 1;
+    
     if (E.filename == NULL) return;
     
     char *ext = strrchr(E.filename, '.');
@@ -318,11 +724,9 @@ void editorSelectSyntaxHighlight() {
             if ((is_ext && ext && strcmp(ext, s->filematch[i]) == 0) ||
                 (!is_ext && strstr(E.filename, s->filematch[i]))) {
                 E.syntax = s;
-                
-                // Apply syntax highlighting to all rows
-                for (int filerow = 0; filerow < E.numrows; filerow++) {
-                    editorUpdateRow(&E.row[filerow]);
-                }
+                pthread_mutex_lock(&syntaxCompileLock);
+                if (!HLDB_tables[j].keywords.slots) syntaxCompile(&HLDB_tables[j], s);
+                pthread_mutex_unlock(&syntaxCompileLock);
                 return;
             }
             i++;
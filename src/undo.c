@@ -0,0 +1,271 @@
+#include "axcode.h"
+
+// Edits are recorded where they are made, at the row primitives in row.c,
+// as operations that insert or delete either text within one row or whole
+// rows. Operations are grouped into the steps that `u` and Ctrl-R undo and
+// redo: every command in normal mode is a step, and so is everything typed
+// between entering insert mode and leaving it. Typing or deleting in one
+// place grows a single operation instead of adding one per key, and a paste
+// of any size is one operation on whole rows.
+struct undoOp {
+    int type;           // UNDO_INSERT or UNDO_DELETE
+    int rows;           // text is nrows whole rows joined by '\n'
+    int nrows;
+    int row, col;       // Where the text starts
+    char *text;
+    size_t len, cap;
+};
+
+struct undoGroup {
+    struct undoOp *ops;
+    int n, cap;
+    int cy, cx;         // Cursor before the step, restored when it is undone
+    int ry, rx;         // Cursor after the step, restored when it is redone
+    size_t bytes;       // Memory held by the group
+};
+
+struct undoStack {
+    struct undoGroup *groups;
+    int n, cap;
+};
+
+// The history of a buffer, made along with it on its first edit
+struct undoHistory {
+    struct undoStack undos, redos;
+    size_t bytes;       // Memory held by both stacks
+    int open;           // The last step still takes operations
+    int overflow;       // The current step outgrew the budget
+    int replaying;      // Edits being made are undos or redos
+    int cy, cx;         // Cursor when the current step began
+};
+
+static struct undoHistory *undoGet() {
+    if (!E.undo) E.undo = calloc(1, sizeof(struct undoHistory));
+    return E.undo;
+}
+
+static void groupFree(struct undoHistory *h, struct undoGroup *g) {
+    for (int i = 0; i < g->n; i++) free(g->ops[i].text);
+    free(g->ops);
+    h->bytes -= g->bytes;
+}
+
+static void stackClear(struct undoHistory *h, struct undoStack *s) {
+    for (int i = 0; i < s->n; i++) groupFree(h, &s->groups[i]);
+    s->n = 0;
+}
+
+static struct undoGroup *stackPush(struct undoStack *s, struct undoGroup *g) {
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 64;
+        s->groups = realloc(s->groups, sizeof(struct undoGroup) * s->cap);
+    }
+    s->groups[s->n] = *g;
+    return &s->groups[s->n++];
+}
+
+// Forget the oldest steps until the history fits E.undo_budget. A step
+// that does not fit on its own cannot be undone at all, so it is dropped
+// along with the rest of the edits that belong to it.
+static void undoTrim() {
+    struct undoHistory *h = undoGet();
+    int drop = 0;
+    
+    while (drop < h->undos.n && h->bytes > E.undo_budget) {
+        groupFree(h, &h->undos.groups[drop++]);
+    }
+    if (drop == 0) return;
+    
+    h->undos.n -= drop;
+    memmove(h->undos.groups, &h->undos.groups[drop], sizeof(struct undoGroup) * h->undos.n);
+    if (h->undos.n == 0 && h->open) {
+        h->open = 0;
+        h->overflow = 1;
+    }
+}
+
+// Grow op with the text of a new operation that continues it, as when
+// typing along a row or deleting with backspace or x in one place
+static int opMerge(struct undoOp *op, int type, int rows, int row, int col, size_t len) {
+    if (op->type != type || op->rows != rows) return 0;
+    if (rows) return type == UNDO_INSERT && row == op->row + op->nrows;
+    if (op->row != row) return 0;
+    
+    if (type == UNDO_INSERT) return (size_t)col == op->col + op->len;
+    return col == op->col || (size_t)col + len == (size_t)op->col;
+}
+
+static void opAppend(struct undoOp *op, size_t at, const char *text, size_t len) {
+    if (!op->text || op->cap < op->len + len) {
+        size_t cap = op->cap ? op->cap : 16;
+        while (cap < op->len + len) cap *= 2;
+        op->text = realloc(op->text, cap);
+        op->cap = cap;
+    }
+    memmove(&op->text[at + len], &op->text[at], op->len - at);
+    memcpy(&op->text[at], text, len);
+    op->len += len;
+}
+
+int editorUndoRecording() {
+    struct undoHistory *h = undoGet();
+    return !h->replaying && !h->overflow;
+}
+
+// Called by the row primitives before they insert or delete text at
+// row, col; for whole rows the text is the rows joined by '\n'
+void editorUndoRecord(int type, int rows, int row, int col, const char *text, size_t len) {
+    struct undoHistory *h = undoGet();
+    
+    if (!editorUndoRecording()) return;
+    stackClear(h, &h->redos);
+    
+    if (!h->open) {
+        struct undoGroup g = {0};
+        g.cy = h->cy;
+        g.cx = h->cx;
+        stackPush(&h->undos, &g);
+        h->open = 1;
+    }
+    
+    struct undoGroup *g = &h->undos.groups[h->undos.n - 1];
+    struct undoOp *op = g->n ? &g->ops[g->n - 1] : NULL;
+    size_t before = op ? op->cap : 0;
+    
+    if (op && opMerge(op, type, rows, row, col, len)) {
+        if (rows) {
+            opAppend(op, op->len, "\n", 1);
+            op->nrows++;
+        }
+        if (!rows && type == UNDO_DELETE && col != op->col) {
+            opAppend(op, 0, text, len);
+            op->col = col;
+        } else {
+            opAppend(op, op->len, text, len);
+        }
+    } else {
+        if (g->n == g->cap) {
+            g->cap = g->cap ? g->cap * 2 : 4;
+            g->ops = realloc(g->ops, sizeof(struct undoOp) * g->cap);
+            g->bytes += sizeof(struct undoOp) * g->cap / 2;
+            h->bytes += sizeof(struct undoOp) * g->cap / 2;
+        }
+        op = &g->ops[g->n++];
+        memset(op, 0, sizeof(*op));
+        op->type = type;
+        op->rows = rows;
+        op->nrows = 1;
+        op->row = row;
+        op->col = col;
+        before = 0;
+        opAppend(op, 0, text, len);
+    }
+    
+    if (rows)
+        for (size_t i = 0; i < len; i++) op->nrows += text[i] == '\n';
+    g->bytes += op->cap - before;
+    h->bytes += op->cap - before;
+    undoTrim();
+}
+
+// End the current step; the next edit starts a new one
+void editorUndoBreak() {
+    struct undoHistory *h = undoGet();
+    
+    h->open = 0;
+    h->overflow = 0;
+    h->cy = E.cy;
+    h->cx = E.cx;
+}
+
+static void opApply(struct undoOp *op, int type) {
+    if (op->rows) {
+        if (type == UNDO_INSERT)
+            editorInsertRows(op->row, op->text, op->len);
+        else
+            editorDelRows(op->row, op->nrows);
+    } else {
+        erow *row = editorRowAt(op->row);
+        if (type == UNDO_INSERT)
+            editorRowInsertString(row, op->col, op->text, op->len);
+        else
+            editorRowDelString(row, op->col, op->len);
+    }
+}
+
+static void undoCursor(int cy, int cx) {
+    E.cy = cy < E.numrows ? cy : E.numrows;
+    if (E.cy < E.numrows && cx > editorRowAt(E.cy)->size) cx = editorRowAt(E.cy)->size;
+    if (E.cy == E.numrows) cx = 0;
+    E.cx = cx;
+}
+
+void editorUndo() {
+    struct undoHistory *h = undoGet();
+    
+    editorUndoBreak();
+    if (h->undos.n == 0) {
+        editorSetStatusMessage("Already at oldest change");
+        return;
+    }
+    
+    struct undoGroup g = h->undos.groups[--h->undos.n];
+    g.ry = E.cy;
+    g.rx = E.cx;
+    
+    h->replaying = 1;
+    for (int i = g.n - 1; i >= 0; i--)
+        opApply(&g.ops[i], g.ops[i].type == UNDO_INSERT ? UNDO_DELETE : UNDO_INSERT);
+    h->replaying = 0;
+    
+    stackPush(&h->redos, &g);
+    undoCursor(g.cy, g.cx);
+    editorUndoBreak();
+}
+
+void editorRedo() {
+    struct undoHistory *h = undoGet();
+    
+    editorUndoBreak();
+    if (h->redos.n == 0) {
+        editorSetStatusMessage("Already at newest change");
+        return;
+    }
+    
+    struct undoGroup g = h->redos.groups[--h->redos.n];
+    
+    h->replaying = 1;
+    for (int i = 0; i < g.n; i++)
+        opApply(&g.ops[i], g.ops[i].type);
+    h->replaying = 0;
+    
+    stackPush(&h->undos, &g);
+    undoCursor(g.ry, g.rx);
+    editorUndoBreak();
+}
+
+// Forget all history, as when another file is opened
+void editorUndoClear() {
+    struct undoHistory *h = undoGet();
+    
+    stackClear(h, &h->undos);
+    stackClear(h, &h->redos);
+    h->open = 0;
+    h->overflow = 0;
+}
+
+// Free the history along with the buffer it belongs to
+void editorUndoFree() {
+    if (!E.undo) return;
+    
+    editorUndoClear();
+    free(E.undo->undos.groups);
+    free(E.undo->redos.groups);
+    free(E.undo);
+    E.undo = NULL;
+}
+
+// Memory held by history h, which may belong to a buffer put away
+size_t editorUndoSize(const struct undoHistory *h) {
+    return h ? h->bytes : 0;
+}